@@ -36,7 +36,11 @@ static uint64_t fdt64_to_cpu(uint64_t x) {
            fdt32_to_cpu(x >> 32);
 }
 
-// 简化的内存信息提取函数
+// 从/chosen节点复制出的内核命令行（DTB所在内存之后可能被PMM回收）
+#define BOOTARGS_MAX    256
+static char bootargs[BOOTARGS_MAX];
+
+// 简化的内存信息提取函数，顺带取出/chosen/bootargs
 static int extract_memory_info(uintptr_t dtb_vaddr, const struct fdt_header *header, 
                               uint64_t *mem_base, uint64_t *mem_size) {
     uint32_t struct_offset = fdt32_to_cpu(header->off_dt_struct);
@@ -46,6 +50,9 @@ static int extract_memory_info(uintptr_t dtb_vaddr, const struct fdt_header *hea
     const uint32_t *struct_ptr = (const uint32_t *)(dtb_vaddr + struct_offset);
     
     int in_memory_node = 0;
+    int in_chosen_node = 0;
+    int depth = 0;          // 根节点的深度为1
+    int found = 0;
     
     while (1) {
         uint32_t token = fdt32_to_cpu(*struct_ptr++);
@@ -59,6 +66,10 @@ static int extract_memory_info(uintptr_t dtb_vaddr, const struct fdt_header *hea
                 if (strncmp(name, "memory", 6) == 0) {
                     in_memory_node = 1;
                 }
+                // 检查是否是根节点下的chosen节点
+                if (++depth == 2 && strcmp(name, "chosen") == 0) {
+                    in_chosen_node = 1;
+                }
                 
                 // 跳过节点名（4字节对齐）
                 struct_ptr = (const uint32_t *)(((uintptr_t)struct_ptr + name_len + 4) & ~3);
@@ -67,6 +78,9 @@ static int extract_memory_info(uintptr_t dtb_vaddr, const struct fdt_header *hea
             
             case FDT_END_NODE:
                 in_memory_node = 0;
+                if (depth-- == 2) {
+                    in_chosen_node = 0;
+                }
                 break;
                 
             case FDT_PROP: {
@@ -76,11 +90,21 @@ static int extract_memory_info(uintptr_t dtb_vaddr, const struct fdt_header *hea
                 const void *prop_data = struct_ptr;
                 
                 // 在memory节点中查找reg属性
-                if (in_memory_node && strcmp(prop_name, "reg") == 0 && prop_len >= 16) {
+                if (!found && in_memory_node && strcmp(prop_name, "reg") == 0 && prop_len >= 16) {
                     const uint64_t *reg_data = (const uint64_t *)prop_data;
                     *mem_base = fdt64_to_cpu(reg_data[0]);
                     *mem_size = fdt64_to_cpu(reg_data[1]);
-                    return 0; // 成功找到
+                    found = 1; // 成功找到，继续扫描以取得bootargs
+                }
+                
+                // 在chosen节点中查找bootargs属性，过长的部分截断
+                if (in_chosen_node && depth == 2 && strcmp(prop_name, "bootargs") == 0) {
+                    size_t n = strnlen((const char *)prop_data, prop_len);
+                    if (n >= BOOTARGS_MAX) {
+                        n = BOOTARGS_MAX - 1;
+                    }
+                    memcpy(bootargs, prop_data, n);
+                    bootargs[n] = '\0';
                 }
                 
                 // 跳过属性数据（4字节对齐）
@@ -92,7 +116,7 @@ static int extract_memory_info(uintptr_t dtb_vaddr, const struct fdt_header *hea
                 break;
                 
             case FDT_END:
-                return -1; // 没有找到
+                return found ? 0 : -1; // 是否找到memory节点
                 
             default:
                 return -1; // 错误
@@ -138,6 +162,9 @@ void dtb_init(void) {
     } else {
         cprintf("Warning: Could not extract memory info from DTB\n");
     }
+    if (bootargs[0] != '\0') {
+        cprintf("Bootargs: %s\n", bootargs);
+    }
     cprintf("DTB init completed\n");
 }
 
@@ -147,4 +174,30 @@ uint64_t get_memory_base(void) {
 
 uint64_t get_memory_size(void) {
     return memory_size;
+}
+
+const char *get_bootargs(void) {
+    return bootargs;
+}
+
+// get_bootarg - 在命令行中查找"key=value"，返回value并通过len给出其长度，
+// 没有该参数时返回NULL
+const char *get_bootarg(const char *key, size_t *len) {
+    size_t klen = strlen(key);
+    const char *p = bootargs;
+    while (*p != '\0') {
+        while (*p == ' ') {
+            p++;
+        }
+        const char *end = p;
+        while (*end != '\0' && *end != ' ') {
+            end++;
+        }
+        if ((size_t)(end - p) > klen && strncmp(p, key, klen) == 0 && p[klen] == '=') {
+            *len = end - p - klen - 1;
+            return p + klen + 1;
+        }
+        p = end;
+    }
+    return NULL;
 }
\ No newline at end of file
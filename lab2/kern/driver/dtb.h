@@ -10,5 +10,7 @@ extern uint64_t boot_dtb;
 void dtb_init(void);
 uint64_t get_memory_base(void);
 uint64_t get_memory_size(void);
+const char *get_bootargs(void);
+const char *get_bootarg(const char *key, size_t *len);
 
 #endif /* !__KERN_DRIVER_DTB_H__ */
\ No newline at end of file
@@ -77,8 +77,7 @@ best_fit_init_memmap(struct Page *base, size_t n) {
         p->flags = 0;
         set_page_ref(p, 0);
     }
-    base->property = n;
-    SetPageProperty(base);
+    set_block_tags(base, n);
     nr_free += n;
     if (list_empty(&free_list)) {
         list_add(&free_list, &(base->page_link));
@@ -127,8 +126,7 @@ best_fit_alloc_pages(size_t n) {
         list_del(&(page->page_link));
         if (page->property > n) {
             struct Page *p = page + n;
-            p->property = page->property - n;
-            SetPageProperty(p);
+            set_block_tags(p, page->property - n);
             list_add_before(list_next(prev), &(p->page_link));
         }
         nr_free -= n;
@@ -138,6 +136,51 @@ best_fit_alloc_pages(size_t n) {
     return page;
 }
 
+// carve_block - allocate [base, base + n) from inside the free block; what
+// is left before and after it stays free, in the block's place in the list
+static void
+carve_block(struct Page *block, struct Page *base, size_t n) {
+    struct Page *end = block + block->property;
+    list_entry_t *prev = list_prev(&(block->page_link));
+    list_del(&(block->page_link));
+    ClearPageProperty(block);
+    if (base + n < end) {
+        set_block_tags(base + n, end - (base + n));
+        list_add(prev, &(base[n].page_link));
+    }
+    if (base > block) {
+        set_block_tags(block, base - block);
+        list_add(prev, &(block->page_link));
+    }
+    nr_free -= n;
+}
+
+// best_fit_alloc_pages_aligned - best fit among the free blocks that hold n
+// pages starting at a page number that is a multiple of align
+static struct Page *
+best_fit_alloc_pages_aligned(size_t n, size_t align) {
+    assert(n > 0 && (align & (align - 1)) == 0);
+    if (n > nr_free) {
+        return NULL;
+    }
+    struct Page *block = NULL, *page = NULL;
+    size_t min_size = nr_free + 1;
+    list_entry_t *le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        struct Page *p = le2page(le, page_link);
+        struct Page *base = p + (ROUNDUP(page2ppn(p), align) - page2ppn(p));
+        if (base + n <= p + p->property && p->property < min_size) {
+            min_size = p->property;
+            block = p;
+            page = base;
+        }
+    }
+    if (page != NULL) {
+        carve_block(block, page, n);
+    }
+    return page;
+}
+
 static void
 best_fit_free_pages(struct Page *base, size_t n) {
     assert(n > 0);
@@ -150,56 +193,22 @@ best_fit_free_pages(struct Page *base, size_t n) {
     /*LAB2 EXERCISE 2: YOUR CODE*/ 
     // 编写代码
     // 具体来说就是设置当前页块的属性为释放的页块数、并将当前页块标记为已分配状态、最后增加nr_free的值
-    ClearPageProperty(base);  // 先清除
-    base->property = n;
-    SetPageProperty(base);
     nr_free += n;
 
-    if (list_empty(&free_list)) {
-        list_add(&free_list, &(base->page_link));
-    } else {
-        list_entry_t* le = &free_list;
-        while ((le = list_next(le)) != &free_list) {
-            struct Page* page = le2page(le, page_link);
-            if (base < page) {
-                list_add_before(le, &(base->page_link));
-                break;
-            } 
-        }
-         // 如果循环结束还没break，说明要插入到末尾
-        if (le == &free_list) {
-            list_add_before(&free_list, &(base->page_link));
-        }
+    // 通过边界标记直接找到物理上相邻的空闲块并合并，不需要遍历链表；
+    // best-fit 只看块的大小，不依赖链表按地址有序，合并后的块挂在链表头即可
+    if ((p = next_free_block(base, n)) != NULL) {
+        n += p->property;
+        ClearPageProperty(p);
+        list_del(&(p->page_link));
     }
-
-    list_entry_t* le = list_prev(&(base->page_link));
-    
-    if (le != &free_list) {
-        p = le2page(le, page_link);
-        /*LAB2 EXERCISE 2: YOUR CODE*/ 
-        // 编写代码
-        // 1、判断前面的空闲页块是否与当前页块是连续的，如果是连续的，则将当前页块合并到前面的空闲页块中
-        // 2、首先更新前一个空闲页块的大小，加上当前页块的大小
-        // 3、清除当前页块的属性标记，表示不再是空闲页块
-        // 4、从链表中删除当前页块
-        // 5、将指针指向前一个空闲页块，以便继续检查合并后的连续空闲页块
-
-        if (p+p->property == base) {
-            p->property += base->property;
-            ClearPageProperty(base);
-            list_del(&(base->page_link));
-            base = p;
-        }
-    }
-    le = list_next(&(base->page_link));
-    if (le != &free_list) {
-        p = le2page(le, page_link);
-        if (base + base->property == p) {
-            base->property += p->property;
-            ClearPageProperty(p);
-            list_del(&(p->page_link));
-        }
+    if ((p = prev_free_block(base)) != NULL) {
+        n += p->property;
+        list_del(&(p->page_link));
+        base = p;
     }
+    set_block_tags(base, n);
+    list_add(&free_list, &(base->page_link));
 }
 
 static size_t
@@ -207,6 +216,42 @@ best_fit_nr_free_pages(void) {
     return nr_free;
 }
 
+static void
+best_fit_stats(struct pmm_stats *st) {
+    list_entry_t *le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        pmm_stats_add_blocks(st, le2page(le, page_link)->property, 1);
+    }
+}
+
+// hold_free_blocks - allocate every free block whole, chained on held through
+// page_link, so the checks below see an empty manager. Merging follows the
+// physical neighbours, so the free blocks must really be taken rather than
+// just unlinked from free_list.
+static void
+hold_free_blocks(list_entry_t *held) {
+    list_init(held);
+    while (!list_empty(&free_list)) {
+        struct Page *p = le2page(list_next(&free_list), page_link);
+        size_t n = p->property;
+        assert(alloc_pages(n) == p);
+        p->property = n;
+        list_add_before(held, &(p->page_link));
+    }
+    assert(nr_free == 0);
+}
+
+// release_free_blocks - give back everything hold_free_blocks took
+static void
+release_free_blocks(list_entry_t *held) {
+    while (!list_empty(held)) {
+        list_entry_t *le = list_next(held);
+        list_del(le);
+        struct Page *p = le2page(le, page_link);
+        free_pages(p, p->property);
+    }
+}
+
 static void
 basic_check(void) {
     struct Page *p0, *p1, *p2;
@@ -222,13 +267,10 @@ basic_check(void) {
     assert(page2pa(p1) < npage * PGSIZE);
     assert(page2pa(p2) < npage * PGSIZE);
 
-    list_entry_t free_list_store = free_list;
-    list_init(&free_list);
+    list_entry_t held;
+    hold_free_blocks(&held);
     assert(list_empty(&free_list));
 
-    unsigned int nr_free_store = nr_free;
-    nr_free = 0;
-
     assert(alloc_page() == NULL);
 
     free_page(p0);
@@ -250,8 +292,7 @@ basic_check(void) {
     assert(alloc_page() == NULL);
 
     assert(nr_free == 0);
-    free_list = free_list_store;
-    nr_free = nr_free_store;
+    release_free_blocks(&held);
 
     free_page(p);
     free_page(p1);
@@ -286,8 +327,8 @@ best_fit_check(void) {
     score += 1;
     cprintf("grading: %d / %d points\n",score, sumscore);
     #endif
-    list_entry_t free_list_store = free_list;
-    list_init(&free_list);
+    list_entry_t held;
+    hold_free_blocks(&held);
     assert(list_empty(&free_list));
     assert(alloc_page() == NULL);
 
@@ -295,9 +336,6 @@ best_fit_check(void) {
     score += 1;
     cprintf("grading: %d / %d points\n",score, sumscore);
     #endif
-    unsigned int nr_free_store = nr_free;
-    nr_free = 0;
-
     // * - - * -
     free_pages(p0 + 1, 2);
     free_pages(p0 + 4, 1);
@@ -322,9 +360,7 @@ best_fit_check(void) {
     cprintf("grading: %d / %d points\n",score, sumscore);
     #endif
     assert(nr_free == 0);
-    nr_free = nr_free_store;
-
-    free_list = free_list_store;
+    release_free_blocks(&held);
     free_pages(p0, 5);
 
     le = &free_list;
@@ -338,6 +374,8 @@ best_fit_check(void) {
     score += 1;
     cprintf("grading: %d / %d points\n",score, sumscore);
     #endif
+
+    pmm_bench();
 }
 
 const struct pmm_manager best_fit_pmm_manager = {
@@ -348,5 +386,7 @@ const struct pmm_manager best_fit_pmm_manager = {
     .free_pages = best_fit_free_pages,
     .nr_free_pages = best_fit_nr_free_pages,
     .check = best_fit_check,
+    .stats = best_fit_stats,
+    .alloc_pages_aligned = best_fit_alloc_pages_aligned,
 };
 
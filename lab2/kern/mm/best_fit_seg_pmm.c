@@ -0,0 +1,235 @@
+#include <pmm.h>
+#include <list.h>
+#include <string.h>
+#include <bitops.h>
+#include <best_fit_seg_pmm.h>
+#include <stdio.h>
+
+/* Segregated best fit.
+ * Free blocks are kept in size classes instead of one address-ordered list:
+ *   - class 0 .. SEG_EXACT-1 hold blocks of exactly 1 .. SEG_EXACT pages;
+ *   - every further class holds the blocks in [2^k, 2^(k+1)), sorted by size
+ *     (then by address), so the first block that fits is also the best one.
+ * A bitmap of non-empty classes finds the next class with a block in O(1).
+ *
+ * Coalescing still goes by address, but through the physical neighbours
+ * found by the boundary tags in pmm.h, so free_pages needs no list walk.
+ */
+
+#define SEG_EXACT       16                      // classes with one exact size
+#define SEG_NR_CLASSES  (SEG_EXACT + 32 - 4)    // 17 .. 2^32-1 pages in 2^k classes
+
+static struct {
+    free_area_t classes[SEG_NR_CLASSES];    // nr_free: number of blocks in the class
+    uint64_t nonempty;                      // bit i set iff classes[i] is not empty
+    size_t nr_free;                         // total number of free pages
+} seg;
+
+#define class_list(c) (seg.classes[(c)].free_list)
+#define class_nr(c) (seg.classes[(c)].nr_free)
+
+// size_class - class holding blocks of n pages
+static int
+size_class(size_t n) {
+    if (n <= SEG_EXACT) {
+        return n - 1;
+    }
+    int log = 0;
+    while ((n >> log) > 1) {
+        log++;
+    }
+    return SEG_EXACT + log - 4;     // 17..31 -> 16, 32..63 -> 17, ...
+}
+
+static void
+seg_insert(struct Page *base, size_t n) {
+    int c = size_class(n);
+    set_block_tags(base, n);
+
+    list_entry_t *le = &class_list(c);
+    if (c >= SEG_EXACT) {
+        // keep the class sorted by (size, address)
+        while ((le = list_next(le)) != &class_list(c)) {
+            struct Page *p = le2page(le, page_link);
+            if (p->property > n || (p->property == n && p > base)) {
+                break;
+            }
+        }
+        list_add_before(le, &(base->page_link));
+    } else {
+        list_add(le, &(base->page_link));
+    }
+    class_nr(c)++;
+    seg.nonempty |= 1ULL << c;
+}
+
+static void
+seg_remove(struct Page *base) {
+    int c = size_class(base->property);
+    list_del(&(base->page_link));
+    ClearPageProperty(base);
+    if (--class_nr(c) == 0) {
+        seg.nonempty &= ~(1ULL << c);
+    }
+}
+
+static void
+best_fit_seg_init(void) {
+    for (int c = 0; c < SEG_NR_CLASSES; c++) {
+        list_init(&class_list(c));
+        class_nr(c) = 0;
+    }
+    seg.nonempty = 0;
+    seg.nr_free = 0;
+}
+
+static void
+best_fit_seg_init_memmap(struct Page *base, size_t n) {
+    assert(n > 0);
+    struct Page *p = base;
+    for (; p != base + n; p ++) {
+        assert(PageReserved(p));
+        p->flags = p->property = 0;
+        set_page_ref(p, 0);
+    }
+    seg_insert(base, n);
+    seg.nr_free += n;
+}
+
+static struct Page *
+best_fit_seg_alloc_pages(size_t n) {
+    assert(n > 0);
+    if (n > seg.nr_free) {
+        return NULL;
+    }
+    struct Page *page = NULL;
+    int c = size_class(n);
+
+    // in a sorted range class, the first block of at least n pages is the best
+    if (c >= SEG_EXACT) {
+        list_entry_t *le = &class_list(c);
+        while ((le = list_next(le)) != &class_list(c)) {
+            struct Page *p = le2page(le, page_link);
+            if (p->property >= n) {
+                page = p;
+                break;
+            }
+        }
+        c++;
+    }
+    // otherwise the smallest block of the next non-empty class
+    if (page == NULL) {
+        uint64_t mask = c < SEG_NR_CLASSES ? seg.nonempty & ~((1ULL << c) - 1) : 0;
+        if (mask == 0) {
+            return NULL;
+        }
+        page = le2page(list_next(&class_list(ctz64(mask))), page_link);
+    }
+
+    size_t size = page->property;
+    seg_remove(page);
+    if (size > n) {
+        seg_insert(page + n, size - n);
+    }
+    seg.nr_free -= n;
+    return page;
+}
+
+static void
+best_fit_seg_free_pages(struct Page *base, size_t n) {
+    assert(n > 0);
+    struct Page *p = base;
+    for (; p != base + n; p ++) {
+        assert(!PageReserved(p) && !PageProperty(p));
+        p->flags = 0;
+        set_page_ref(p, 0);
+    }
+    seg.nr_free += n;
+
+    if ((p = next_free_block(base, n)) != NULL) {
+        n += p->property;
+        seg_remove(p);
+    }
+    if ((p = prev_free_block(base)) != NULL) {
+        n += p->property;
+        seg_remove(p);
+        base = p;
+    }
+    seg_insert(base, n);
+}
+
+static size_t
+best_fit_seg_nr_free_pages(void) {
+    return seg.nr_free;
+}
+
+// seg_count - walk every class and check it against the counters
+static size_t
+seg_count(void) {
+    size_t total = 0;
+    for (int c = 0; c < SEG_NR_CLASSES; c++) {
+        size_t blocks = 0, last = 0;
+        list_entry_t *le = &class_list(c);
+        while ((le = list_next(le)) != &class_list(c)) {
+            struct Page *p = le2page(le, page_link);
+            assert(PageProperty(p) && size_class(p->property) == c);
+            assert(p[p->property - 1].property == p->property);
+            assert(c < SEG_EXACT || p->property >= last);
+            last = p->property;
+            total += p->property;
+            blocks++;
+        }
+        assert(blocks == class_nr(c));
+        assert(((seg.nonempty >> c) & 1) == (blocks != 0));
+    }
+    assert(total == seg.nr_free);
+    return total;
+}
+
+static void
+best_fit_seg_check(void) {
+    size_t total = seg_count();
+    assert(total == nr_free_pages());
+
+    struct Page *p0 = alloc_pages(32), *p1, *p2, *p3;
+    assert(p0 != NULL && !PageProperty(p0));
+
+    // * - - - * - * - - * ...  holes of 3, 1 and 2 pages between guard pages
+    free_pages(p0 + 1, 3);
+    free_pages(p0 + 5, 1);
+    free_pages(p0 + 7, 2);
+    assert(PageProperty(p0 + 1) && p0[1].property == 3 && p0[3].property == 3);
+    assert(seg_count() == total - 26);
+
+    // each request lands in the hole that fits it best
+    assert((p1 = alloc_pages(2)) == p0 + 7);
+    assert((p2 = alloc_page()) == p0 + 5);
+    assert((p3 = alloc_pages(3)) == p0 + 1);
+    assert(seg_count() == total - 32);
+
+    // freeing the guards merges the holes with both neighbours
+    free_pages(p3, 3);
+    free_pages(p2, 1);
+    free_pages(p0 + 4, 1);
+    assert(PageProperty(p0 + 1) && p0[1].property == 5 && p0[5].property == 5);
+    free_pages(p0 + 6, 1);
+    free_pages(p1, 2);
+    assert(PageProperty(p0 + 1) && p0[1].property == 8 && p0[8].property == 8);
+    free_pages(p0 + 9, 22);
+    assert(PageProperty(p0 + 1) && p0[1].property == 30);
+    free_pages(p0, 1);
+    free_pages(p0 + 31, 1);
+    assert(seg_count() == total);
+
+    pmm_bench();
+}
+
+const struct pmm_manager best_fit_seg_pmm_manager = {
+    .name = "best_fit_seg_pmm_manager",
+    .init = best_fit_seg_init,
+    .init_memmap = best_fit_seg_init_memmap,
+    .alloc_pages = best_fit_seg_alloc_pages,
+    .free_pages = best_fit_seg_free_pages,
+    .nr_free_pages = best_fit_seg_nr_free_pages,
+    .check = best_fit_seg_check,
+};
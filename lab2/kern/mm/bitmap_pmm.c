@@ -0,0 +1,225 @@
+#include <pmm.h>
+#include <string.h>
+#include <bitops.h>
+#include <bitmap_pmm.h>
+#include <stdio.h>
+
+/* Bitmap frame allocator.
+ * One bit per frame of the pages array, set while the frame is free, plus a
+ * summary with one bit per 64-bit word of the bitmap, set while that word
+ * has a free frame. Free memory is found with word-at-a-time ctz scans over
+ * the two levels instead of chasing page_link lists through struct Page,
+ * and a request for n pages takes the lowest run of n free frames.
+ */
+
+#define BITMAP_MAX_FRAMES   (1UL << 18)                 // 1 GiB, all that entry.S maps
+#define BITMAP_WORDS        (BITMAP_MAX_FRAMES / 64)
+#define SUMMARY_WORDS       (BITMAP_WORDS / 64)
+
+static struct {
+    uint64_t map[BITMAP_WORDS];         // bit i set iff pages[i] is free
+    uint64_t summary[SUMMARY_WORDS];    // bit w set iff map[w] != 0
+    size_t nbits;                       // number of frames the bitmap covers
+    size_t nr_free;                     // total number of free pages
+} bm;
+
+static inline void
+update_summary(size_t w) {
+    if (bm.map[w] != 0) {
+        bm.summary[w / 64] |= 1ULL << (w % 64);
+    } else {
+        bm.summary[w / 64] &= ~(1ULL << (w % 64));
+    }
+}
+
+// mark_range - mark frames [start, start + n) free or in use, a word at a time
+static void
+mark_range(size_t start, size_t n, bool free) {
+    while (n > 0) {
+        size_t w = start / 64, b = start % 64;
+        size_t len = (64 - b < n) ? 64 - b : n;
+        uint64_t mask = (len == 64 ? ~0ULL : (1ULL << len) - 1) << b;
+        if (free) {
+            assert((bm.map[w] & mask) == 0);
+            bm.map[w] |= mask;
+        } else {
+            assert((bm.map[w] & mask) == mask);
+            bm.map[w] &= ~mask;
+        }
+        update_summary(w);
+        start += len;
+        n -= len;
+    }
+}
+
+// next_free - first free frame at or after pos, bm.nbits if there is none
+static size_t
+next_free(size_t pos) {
+    if (pos >= bm.nbits) {
+        return bm.nbits;
+    }
+    size_t w = pos / 64;
+    uint64_t bits = bm.map[w] & (~0ULL << (pos % 64));
+    if (bits != 0) {
+        return w * 64 + ctz64(bits);
+    }
+    // the summary skips 64 words (4096 frames) per step
+    for (size_t s = ++w / 64; s < SUMMARY_WORDS; s++) {
+        uint64_t sum = bm.summary[s];
+        if (s == w / 64) {
+            sum &= ~0ULL << (w % 64);
+        }
+        if (sum != 0) {
+            w = s * 64 + ctz64(sum);
+            return w * 64 + ctz64(bm.map[w]);
+        }
+    }
+    return bm.nbits;
+}
+
+// next_used - first frame in use at or after pos, bm.nbits if there is none
+static size_t
+next_used(size_t pos) {
+    size_t w = pos / 64;
+    uint64_t bits = ~bm.map[w] & (~0ULL << (pos % 64));
+    while (bits == 0) {
+        if (++w == BITMAP_WORDS) {
+            return bm.nbits;
+        }
+        bits = ~bm.map[w];
+    }
+    pos = w * 64 + ctz64(bits);
+    return pos < bm.nbits ? pos : bm.nbits;
+}
+
+static void
+bitmap_init(void) {
+    memset(&bm, 0, sizeof(bm));
+}
+
+static void
+bitmap_init_memmap(struct Page *base, size_t n) {
+    assert(n > 0);
+    size_t start = base - pages;
+    if (start + n > BITMAP_MAX_FRAMES) {
+        cprintf("bitmap_pmm: frames past %lu left unmanaged\n", BITMAP_MAX_FRAMES);
+        if (start >= BITMAP_MAX_FRAMES) {
+            return;
+        }
+        n = BITMAP_MAX_FRAMES - start;
+    }
+    struct Page *p = base;
+    for (; p != base + n; p ++) {
+        assert(PageReserved(p));
+        p->flags = p->property = 0;
+        set_page_ref(p, 0);
+    }
+    mark_range(start, n, 1);
+    if (bm.nbits < start + n) {
+        bm.nbits = start + n;
+    }
+    bm.nr_free += n;
+}
+
+static struct Page *
+bitmap_alloc_pages(size_t n) {
+    assert(n > 0);
+    if (n > bm.nr_free) {
+        return NULL;
+    }
+    // walk the runs of free frames from the bottom: each run is bounded by
+    // two ctz scans, one for its first free and one for its first used frame
+    size_t start = next_free(0);
+    while (start < bm.nbits) {
+        size_t end = next_used(start);
+        if (end - start >= n) {
+            mark_range(start, n, 0);
+            bm.nr_free -= n;
+            return pages + start;
+        }
+        start = next_free(end);
+    }
+    return NULL;
+}
+
+static void
+bitmap_free_pages(struct Page *base, size_t n) {
+    assert(n > 0);
+    struct Page *p = base;
+    for (; p != base + n; p ++) {
+        assert(!PageReserved(p) && !PageProperty(p));
+        p->flags = 0;
+        set_page_ref(p, 0);
+    }
+    mark_range(base - pages, n, 1);
+    bm.nr_free += n;
+}
+
+static size_t
+bitmap_nr_free_pages(void) {
+    return bm.nr_free;
+}
+
+// bitmap_count - count the free frames and check the summary against the map
+static size_t
+bitmap_count(void) {
+    size_t total = 0;
+    for (size_t w = 0; w < BITMAP_WORDS; w++) {
+        assert(((bm.summary[w / 64] >> (w % 64)) & 1) == (bm.map[w] != 0));
+        for (uint64_t x = bm.map[w]; x != 0; x &= x - 1) {
+            total++;
+        }
+    }
+    assert(total == bm.nr_free);
+    return total;
+}
+
+static void
+bitmap_check(void) {
+    size_t total = bitmap_count();
+    assert(total == nr_free_pages());
+
+    struct Page *p0 = alloc_pages(32), *p1, *p2, *p3, *p4;
+    assert(p0 != NULL && next_free(0) == (size_t)(p0 - pages) + 32);
+
+    // * - - - * - * - - * ...  holes of 3, 1 and 2 pages between used pages
+    free_pages(p0 + 1, 3);
+    free_pages(p0 + 5, 1);
+    free_pages(p0 + 7, 2);
+    assert(bitmap_count() == total - 26);
+
+    // every request takes the lowest run that is long enough
+    assert((p1 = alloc_pages(2)) == p0 + 1);
+    assert((p2 = alloc_pages(2)) == p0 + 7);
+    assert((p3 = alloc_page()) == p0 + 3);
+    assert((p4 = alloc_page()) == p0 + 5);
+    assert(bitmap_count() == total - 32);
+    free_pages(p1, 2);
+    free_pages(p2, 2);
+    free_page(p3);
+    free_page(p4);
+
+    // runs that span several bitmap words
+    free_page(p0);
+    free_page(p0 + 4);
+    free_page(p0 + 6);
+    free_pages(p0 + 9, 23);
+    assert(bitmap_count() == total);
+    assert((p1 = alloc_pages(200)) == p0);
+    free_pages(p1 + 60, 10);
+    assert(alloc_pages(11) == p1 + 200 && alloc_pages(10) == p1 + 60);
+    free_pages(p1, 211);
+    assert(bitmap_count() == total);
+
+    pmm_bench();
+}
+
+const struct pmm_manager bitmap_pmm_manager = {
+    .name = "bitmap_pmm_manager",
+    .init = bitmap_init,
+    .init_memmap = bitmap_init_memmap,
+    .alloc_pages = bitmap_alloc_pages,
+    .free_pages = bitmap_free_pages,
+    .nr_free_pages = bitmap_nr_free_pages,
+    .check = bitmap_check,
+};
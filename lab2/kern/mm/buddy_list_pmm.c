@@ -0,0 +1,215 @@
+// kern/mm/buddy_list_pmm.c
+// ---------------- PER-ORDER FREE LIST VERSION ----------------
+
+#include <pmm.h>
+#include <list.h>
+#include <string.h>
+#include <stdio.h>
+#include <buddy_list_pmm.h>
+
+/*
+ * 经典的按阶空闲链表伙伴系统：
+ *   - 每个阶 k 维护一条空闲链表，链表中每个块大小为 2^k 页，且物理页号按 2^k 对齐；
+ *   - 空闲块的首页置 PG_property，property 字段记录该块的阶；
+ *   - 伙伴块的页号 = 本块页号 ^ (1 << k)，合并时无需遍历任何结构。
+ * 单页分配/释放在常见情况下只涉及一次链表插入/删除，为 O(1)。
+ */
+
+typedef struct {
+    free_area_t free_area[BUDDY_MAX_ORDER];  // 每阶一条空闲链表，nr_free 为该阶空闲块数
+    size_t nr_free;                          // 空闲页总数
+} buddy_list_t;
+
+static buddy_list_t buddy_list;
+
+#define free_list(order) (buddy_list.free_area[(order)].free_list)
+#define nr_blocks(order) (buddy_list.free_area[(order)].nr_free)
+
+// 满足 2^order >= n 的最小阶
+static unsigned order_of(size_t n) {
+    unsigned order = 0;
+    while (((size_t)1 << order) < n) order++;
+    return order;
+}
+
+// 按物理页号取 Page，超出 pages 数组范围时返回 NULL
+static inline struct Page *ppn2page(ppn_t ppn) {
+    if (ppn < nbase || ppn >= npage) return NULL;
+    return pages + (ppn - nbase);
+}
+
+static inline void push_block(struct Page *page, unsigned order) {
+    page->property = order;
+    SetPageProperty(page);
+    list_add(&free_list(order), &(page->page_link));
+    nr_blocks(order)++;
+}
+
+static inline void pop_block(struct Page *page, unsigned order) {
+    list_del(&(page->page_link));
+    ClearPageProperty(page);
+    nr_blocks(order)--;
+}
+
+static void buddy_list_init(void) {
+    for (int i = 0; i < BUDDY_MAX_ORDER; i++) {
+        list_init(&free_list(i));
+        nr_blocks(i) = 0;
+    }
+    buddy_list.nr_free = 0;
+}
+
+static void buddy_list_init_memmap(struct Page *base, size_t n) {
+    assert(n > 0);
+    struct Page *p = base;
+    for (; p != base + n; p++) {
+        assert(PageReserved(p));
+        p->flags = p->property = 0;
+        set_page_ref(p, 0);
+    }
+
+    // 将 [base, base+n) 切分为若干个按页号自然对齐的最大 2 的幂块
+    ppn_t ppn = page2ppn(base), end = ppn + n;
+    while (ppn < end) {
+        unsigned order = BUDDY_MAX_ORDER - 1;
+        while ((ppn & ((1UL << order) - 1)) || ppn + (1UL << order) > end)
+            order--;
+        push_block(ppn2page(ppn), order);
+        ppn += 1UL << order;
+    }
+    buddy_list.nr_free += n;
+}
+
+// 分配阶为 order 的块，从阶不小于 min_order 的空闲块中拆出。拆分时保留低地址
+// 的一半，所得块的页号按 2^min_order 对齐
+static struct Page *__buddy_list_alloc(unsigned order, unsigned min_order) {
+    if (min_order >= BUDDY_MAX_ORDER) return NULL;
+
+    // 找到第一条非空的、阶不小于 min_order 的链表
+    unsigned cur = min_order;
+    while (cur < BUDDY_MAX_ORDER && list_empty(&free_list(cur))) cur++;
+    if (cur == BUDDY_MAX_ORDER) return NULL;
+
+    struct Page *page = le2page(list_next(&free_list(cur)), page_link);
+    pop_block(page, cur);
+
+    // 逐阶对半拆分，高地址的一半挂回低一阶的链表
+    while (cur > order) {
+        cur--;
+        push_block(page + (1UL << cur), cur);
+    }
+    page->property = order;  // 记录实际分配的阶，释放时校验
+    buddy_list.nr_free -= 1UL << order;
+    return page;
+}
+
+static struct Page *buddy_list_alloc_pages(size_t n) {
+    assert(n > 0);
+    unsigned order = order_of(n);
+    return __buddy_list_alloc(order, order);
+}
+
+// 块按自身大小自然对齐，从不小于 align 的块中拆出即可
+static struct Page *buddy_list_alloc_pages_aligned(size_t n, size_t align) {
+    assert(n > 0 && (align & (align - 1)) == 0);
+    unsigned order = order_of(n), align_order = order_of(align);
+    return __buddy_list_alloc(order, order > align_order ? order : align_order);
+}
+
+static void buddy_list_free_pages(struct Page *base, size_t n) {
+    assert(n > 0);
+    unsigned order = order_of(n);
+    ppn_t ppn = page2ppn(base);
+    assert(order < BUDDY_MAX_ORDER);
+    assert((ppn & ((1UL << order) - 1)) == 0);
+    assert(!PageReserved(base) && !PageProperty(base));
+    base->flags = 0;
+    set_page_ref(base, 0);
+    buddy_list.nr_free += 1UL << order;
+
+    // 伙伴空闲且同阶则合并，直到伙伴不可用或到达最大阶
+    while (order < BUDDY_MAX_ORDER - 1) {
+        struct Page *buddy = ppn2page(ppn ^ (1UL << order));
+        if (buddy == NULL || !PageProperty(buddy) || buddy->property != order)
+            break;
+        pop_block(buddy, order);
+        ppn &= ~(1UL << order);
+        order++;
+    }
+    push_block(ppn2page(ppn), order);
+}
+
+static size_t buddy_list_nr_free_pages(void) {
+    return buddy_list.nr_free;
+}
+
+// buddy_list_nr_free_blocks - 阶为 order 的空闲块个数，O(1)
+size_t buddy_list_nr_free_blocks(unsigned order) {
+    return order < BUDDY_MAX_ORDER ? nr_blocks(order) : 0;
+}
+
+// 空闲块直方图直接来自各阶链表的计数
+static void buddy_list_stats(struct pmm_stats *st) {
+    for (unsigned o = 0; o < BUDDY_MAX_ORDER; o++)
+        pmm_stats_add_blocks(st, (size_t)1 << o, nr_blocks(o));
+}
+
+static void buddy_list_check(void) {
+    cprintf("buddy_check() running (Free list version):\n");
+    size_t total = nr_free_pages();
+
+    // 1. 释放后完全合并，再次分配同样大小得到同一块
+    struct Page *p0 = alloc_pages(8);
+    assert(p0 != NULL && (page2ppn(p0) & 7) == 0);
+    assert(nr_free_pages() == total - 8);
+    free_pages(p0, 8);
+    assert(nr_free_pages() == total);
+    struct Page *p1 = alloc_pages(8);
+    assert(p1 == p0);
+    free_pages(p1, 8);
+
+    // 2. 释放阶 1 块的高半页后再分配单页，拿到的正是它 (伙伴页号异或 1)
+    p0 = alloc_pages(2);
+    assert(p0 != NULL);
+    free_page(p0 + 1);
+    p1 = alloc_page();
+    assert(p1 == p0 + 1 && page2ppn(p1) == (page2ppn(p0) ^ 1));
+    cprintf("  Allocated p0(ppn 0x%lx), p1(ppn 0x%lx).\n", page2ppn(p0), page2ppn(p1));
+
+    // 3. 3 页请求向上取整为 4 页并按 4 对齐
+    struct Page *p2 = alloc_pages(3);
+    assert(p2 != NULL && (page2ppn(p2) & 3) == 0);
+    assert(nr_free_pages() == total - 6);
+    size_t hist_pages = 0;
+    for (unsigned o = 0; o < BUDDY_MAX_ORDER; o++)
+        hist_pages += buddy_list_nr_free_blocks(o) << o;
+    assert(hist_pages == total - 6);
+
+    // 4. 分两次释放的单页合并回阶 1 块，全部释放后恢复初始状态
+    free_page(p0);
+    free_page(p1);
+    free_pages(p2, 3);
+    assert(nr_free_pages() == total);
+    p0 = alloc_pages(2);
+    assert(p0 != NULL && (page2ppn(p0) & 1) == 0);
+    free_pages(p0, 2);
+    assert(nr_free_pages() == total);
+
+    // 5. 超过最大阶的请求失败
+    assert(alloc_pages((1UL << (BUDDY_MAX_ORDER - 1)) + 1) == NULL);
+
+    pmm_bench();
+    cprintf("Buddy system (Free list version) check passed!\n");
+}
+
+const struct pmm_manager buddy_list_pmm_manager = {
+    .name = "buddy_pmm_manager (Free list based)",
+    .init = buddy_list_init,
+    .init_memmap = buddy_list_init_memmap,
+    .alloc_pages = buddy_list_alloc_pages,
+    .free_pages = buddy_list_free_pages,
+    .nr_free_pages = buddy_list_nr_free_pages,
+    .check = buddy_list_check,
+    .stats = buddy_list_stats,
+    .alloc_pages_aligned = buddy_list_alloc_pages_aligned,
+};
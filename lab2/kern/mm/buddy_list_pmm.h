@@ -0,0 +1,14 @@
+// kern/mm/buddy_list_pmm.h
+#ifndef __KERN_MM_BUDDY_LIST_PMM_H__
+#define __KERN_MM_BUDDY_LIST_PMM_H__
+
+#include <pmm.h>
+
+// 最大阶数：阶 0 ~ BUDDY_MAX_ORDER-1，即最大块为 2^(BUDDY_MAX_ORDER-1) 页 (4MiB)
+#define BUDDY_MAX_ORDER     11
+
+extern const struct pmm_manager buddy_list_pmm_manager;
+
+size_t buddy_list_nr_free_blocks(unsigned order);
+
+#endif /* ! __KERN_MM_BUDDY_LIST_PMM_H__ */
@@ -5,18 +5,28 @@
 #include <list.h>
 #include <string.h>
 #include <stdio.h>
+#include <buddy_pmm.h>
 
 // 声明 pmm.c 中定义的全局变量
 extern uint64_t va_pa_offset;
 
-// Buddy System 核心数据结构
+// Buddy System 核心数据结构：一棵二叉树管理一段 2 的幂大小的连续页
 typedef struct {
     unsigned size;           // 管理的总页面数（必须是2的幂）
     unsigned *tree;          // 二叉树节点数组
     struct Page *page_base;  // 可供分配的 Page 数组的基地址
 } buddy_system_t;
 
-static buddy_system_t buddy;
+// 一段任意大小的空闲内存被切分为若干棵按页号自然对齐的树，
+// 多次 init_memmap 调用的树依次追加
+#define BUDDY_MAX_TREES 64
+
+static buddy_system_t buddy[BUDDY_MAX_TREES];
+static int nr_trees;
+
+// 精确的空闲页计数，以及按阶统计的空闲块个数 (完整空闲、且父节点不完整空闲的节点)
+static size_t nr_free;
+static size_t nr_free_blocks[BUDDY_NR_ORDERS];
 
 // 宏定义
 #define IS_POWER_OF_2(x) (!((x) & ((x) - 1)))
@@ -36,159 +46,343 @@ static unsigned fixsize(unsigned size) {
     return size + 1;
 }
 
+// 2的幂 size 对应的阶
+static unsigned order_of_size(unsigned size) {
+    unsigned order = 0;
+    while ((1U << order) < size) order++;
+    return order;
+}
+
+// 不超过 n 的最大的2的幂
+static size_t floor_pow2(size_t n) {
+    size_t size = 1;
+    while ((size << 1) <= n) size <<= 1;
+    return size;
+}
+
+// 把从页号 ppn 开始的 avail 页切成若干棵树 (最多 max_trees 棵)：每棵树的大小
+// 是2的幂，起始页号是其大小的倍数，这样树中每个节点的物理地址都按节点大小对齐。
+// 返回所有树节点数组需要的元数据页数；sizes 非空时按地址顺序记录每棵树的大小
+static size_t plan_trees(ppn_t ppn, size_t avail, int max_trees, unsigned *sizes, int *count) {
+    size_t words = 0;
+    int k = 0;
+    while (avail > 0 && k < max_trees) {
+        size_t size = floor_pow2(avail);
+        while (ppn & (size - 1)) size >>= 1;
+        if (sizes) sizes[k] = size;
+        words += 2 * size - 1;
+        ppn += size;
+        avail -= size;
+        k++;
+    }
+    *count = k;
+    return (sizeof(unsigned) * words + PGSIZE - 1) / PGSIZE;
+}
+
 static void buddy_init(void) {
-    buddy.size = 0;
-    buddy.tree = NULL;
-    buddy.page_base = NULL;
+    nr_trees = 0;
+    memset(buddy, 0, sizeof(buddy));
+    nr_free = 0;
+    memset(nr_free_blocks, 0, sizeof(nr_free_blocks));
 }
 
 static void buddy_init_memmap(struct Page *base, size_t n) {
     assert(n > 0);
-    
-    // 1. 预估树需要多少内存，基于 n 进行预估
-    unsigned est_size = 1;
-    while ((est_size << 1) <= n) est_size <<= 1;
-    if (est_size == 0) panic("Not enough memory to manage.");
-    
-    size_t tree_memsize = sizeof(unsigned) * (2 * est_size - 1);
-    size_t pages_for_tree = (tree_memsize + PGSIZE - 1) / PGSIZE;
-    
-    if (pages_for_tree >= n) {
-        panic("Not enough memory for buddy system metadata");
+    int max_trees = BUDDY_MAX_TREES - nr_trees;
+    if (max_trees == 0) {
+        cprintf("Buddy System (Tree): no tree slot left, %d pages unused.\n", n);
+        return;
     }
 
-    // 2. 正确地为树分配内存
-    // base 指向的第一个物理页，将被我们用来存放树
-    uintptr_t tree_pa = page2pa(base);
-    // 将物理地址转换为内核可以直接访问的虚拟地址
-    buddy.tree = (unsigned *)(tree_pa + va_pa_offset);
-    
-    // 3. 伙伴系统真正管理的 Page 从元数据之后开始
-    buddy.page_base = base + pages_for_tree;
-    size_t allocatable_pages = n - pages_for_tree;
+    // 1. 元数据放在区域开头；它的大小又决定剩下多少页可管理，迭代到不动点
+    size_t pages_for_tree = 0;
+    int count;
+    unsigned sizes[BUDDY_MAX_TREES];
+    while (1) {
+        if (pages_for_tree >= n) {
+            panic("Not enough memory for buddy system metadata");
+        }
+        size_t need = plan_trees(page2ppn(base) + pages_for_tree, n - pages_for_tree,
+                                 max_trees, NULL, &count);
+        if (need <= pages_for_tree) break;
+        pages_for_tree = need;
+    }
+    plan_trees(page2ppn(base) + pages_for_tree, n - pages_for_tree, max_trees, sizes, &count);
 
-    // 4. 基于真正可用的页面数，计算最终的管理大小 (向下取整到2的幂)
-    buddy.size = 1;
-    while ((buddy.size << 1) <= allocatable_pages) buddy.size <<= 1;
+    // base 指向的物理页起存放各棵树的节点数组
+    unsigned *meta = (unsigned *)(page2pa(base) + va_pa_offset);
+    struct Page *page_base = base + pages_for_tree;
+    size_t managed = 0;
 
     cprintf("Buddy System (Tree): Total available %d pages.\n", n);
     cprintf("  Metadata uses first %d pages.\n", pages_for_tree);
-    cprintf("  Managing the next %d pages (rounded down to %d).\n", allocatable_pages, buddy.size);
 
-    // 5. 初始化二叉树
-    unsigned node_size = buddy.size * 2;
-    for (int i = 0; i < 2 * buddy.size - 1; ++i) {
-        if (IS_POWER_OF_2(i + 1))
-            node_size /= 2;
-        buddy.tree[i] = node_size;
+    // 2. 依次初始化每棵树
+    int first = nr_trees;
+    for (int k = 0; k < count; k++) {
+        buddy_system_t *b = &buddy[nr_trees++];
+        b->size = sizes[k];
+        b->tree = meta;
+        b->page_base = page_base;
+
+        unsigned node_size = b->size * 2;
+        for (int i = 0; i < 2 * b->size - 1; ++i) {
+            if (IS_POWER_OF_2(i + 1))
+                node_size /= 2;
+            b->tree[i] = node_size;
+        }
+        // 将我们管理的页面的 Reserved 标志清除
+        for (int i = 0; i < b->size; i++) {
+            ClearPageReserved(b->page_base + i);
+        }
+        nr_free += b->size;
+        nr_free_blocks[order_of_size(b->size)]++;
+
+        meta += 2 * b->size - 1;
+        page_base += b->size;
+        managed += b->size;
     }
-    
-    // 6. 将用于存放树的页面标记为已保留 (非常重要的一步)
+
+    // 对齐切分出的树大小先升后降，按大小从大到小排序，小请求优先落在最大的树上
+    for (int k = first + 1; k < nr_trees; k++) {
+        buddy_system_t t = buddy[k];
+        int j = k;
+        for (; j > first && buddy[j - 1].size < t.size; j--)
+            buddy[j] = buddy[j - 1];
+        buddy[j] = t;
+    }
+    for (int k = first; k < nr_trees; k++) {
+        cprintf("  Tree %d manages %d pages at ppn 0x%lx.\n", k, buddy[k].size,
+                page2ppn(buddy[k].page_base));
+    }
+
+    // 3. 将用于存放树的页面标记为已保留 (非常重要的一步)
     for (int i = 0; i < pages_for_tree; i++) {
         SetPageReserved(base + i);
     }
-
-    // 7. 将我们管理的页面的 Reserved 标志清除
-    for (int i = 0; i < buddy.size; i++) {
-        ClearPageReserved(buddy.page_base + i);
+    if (managed < n - pages_for_tree) {
+        cprintf("  Out of tree slots, %d pages left unmanaged.\n",
+                n - pages_for_tree - managed);
     }
     cprintf("Buddy System (Tree): Initialized successfully\n");
 }
 
-static struct Page *buddy_alloc_pages(size_t n) {
-    assert(n > 0);
-    if (buddy.tree == NULL) return NULL;
-    
-    unsigned req_size = fixsize(n);
-    if (buddy.tree[0] < req_size) return NULL;
+// 取走树中 index 处大小为 req_size 的完整空闲节点
+static struct Page *buddy_tree_take(buddy_system_t *b, unsigned index, unsigned req_size) {
+    // 包含该节点的最大完整空闲祖先，即被拆开的空闲块
+    unsigned split_size = req_size;
+    for (unsigned i = index; i > 0 && b->tree[PARENT(i)] == split_size * 2; i = PARENT(i))
+        split_size *= 2;
+
+    // 大小为 split_size 的空闲块被拆开：它消失，路径上每层剩下的另一半成为新的空闲块
+    unsigned node_size = req_size;
+    unsigned order = order_of_size(req_size);
+    nr_free_blocks[order_of_size(split_size)]--;
+    for (unsigned o = order; (1U << o) < split_size; o++)
+        nr_free_blocks[o]++;
+    nr_free -= req_size;
+
+    b->tree[index] = 0;
+    unsigned offset = (index + 1) * node_size - b->size;
     
+    while (index > 0) {
+        index = PARENT(index);
+        b->tree[index] = MAX(b->tree[LEFT_LEAF(index)], b->tree[RIGHT_LEAF(index)]);
+    }
+    return b->page_base + offset;
+}
+
+// 在单棵树中分配 req_size 页，调用者保证 b->tree[0] >= req_size
+static struct Page *buddy_tree_alloc(buddy_system_t *b, unsigned req_size) {
     unsigned index = 0;
-    unsigned node_size;
-    for (node_size = buddy.size; node_size != req_size; node_size /= 2) {
-        if (buddy.tree[LEFT_LEAF(index)] >= req_size)
+    for (unsigned node_size = b->size; node_size != req_size; node_size /= 2) {
+        if (b->tree[LEFT_LEAF(index)] >= req_size)
             index = LEFT_LEAF(index);
         else
             index = RIGHT_LEAF(index);
     }
-    
-    buddy.tree[index] = 0;
-    unsigned offset = (index + 1) * node_size - buddy.size;
-    
-    while (index > 0) {
-        index = PARENT(index);
-        buddy.tree[index] = MAX(buddy.tree[LEFT_LEAF(index)], buddy.tree[RIGHT_LEAF(index)]);
+    return buddy_tree_take(b, index, req_size);
+}
+
+// 在 index 为根、大小为 node_size 的子树中找一个大小为 req_size、
+// 起始页号是 align 倍数的空闲节点，左子树优先；找不到返回 -1
+static int buddy_tree_find_aligned(buddy_system_t *b, unsigned index, unsigned node_size,
+                                   unsigned req_size, size_t align) {
+    if (b->tree[index] < req_size)
+        return -1;
+    ppn_t first = page2ppn(b->page_base) + (index + 1) * node_size - b->size;
+    if (node_size == req_size)
+        return first % align == 0 ? (int)index : -1;
+    if (ROUNDUP(first, align) >= first + node_size)
+        return -1;  // 子树中没有对齐的位置
+    int found = buddy_tree_find_aligned(b, LEFT_LEAF(index), node_size / 2, req_size, align);
+    if (found < 0)
+        found = buddy_tree_find_aligned(b, RIGHT_LEAF(index), node_size / 2, req_size, align);
+    return found;
+}
+
+static struct Page *buddy_alloc_pages(size_t n) {
+    assert(n > 0);
+    unsigned req_size = fixsize(n);
+
+    // 树按初始化顺序排列 (同一区域内从大到小)，取第一棵放得下的
+    for (int k = 0; k < nr_trees; k++) {
+        if (buddy[k].tree[0] >= req_size) {
+            struct Page *page = buddy_tree_alloc(&buddy[k], req_size);
+            page->property = req_size; // 记录实际分配的大小
+            SetPageProperty(page);
+            return page;
+        }
     }
-    
-    struct Page *page = buddy.page_base + offset;
-    page->property = req_size; // 记录实际分配的大小
-    SetPageProperty(page);
-    return page;
+    return NULL;
+}
+
+// 树按自身大小自然对齐，块不小于 align 时任何空闲块都满足对齐，
+// 更小的块在树中按对齐位置查找
+static struct Page *buddy_alloc_pages_aligned(size_t n, size_t align) {
+    assert(n > 0 && IS_POWER_OF_2(align));
+    unsigned req_size = fixsize(n);
+    if (req_size >= align)
+        return buddy_alloc_pages(n);
+
+    for (int k = 0; k < nr_trees; k++) {
+        int index = buddy_tree_find_aligned(&buddy[k], 0, buddy[k].size, req_size, align);
+        if (index >= 0) {
+            struct Page *page = buddy_tree_take(&buddy[k], index, req_size);
+            page->property = req_size;
+            SetPageProperty(page);
+            return page;
+        }
+    }
+    return NULL;
+}
+
+// 找到 base 所在的树
+static buddy_system_t *buddy_tree_of(struct Page *base) {
+    for (int k = 0; k < nr_trees; k++) {
+        if (base >= buddy[k].page_base && base < buddy[k].page_base + buddy[k].size)
+            return &buddy[k];
+    }
+    return NULL;
 }
 
 static void buddy_free_pages(struct Page *base, size_t n) {
-    assert(base >= buddy.page_base && base < buddy.page_base + buddy.size);
-    unsigned offset = base - buddy.page_base;
+    buddy_system_t *b = buddy_tree_of(base);
+    assert(b != NULL);
+    unsigned offset = base - b->page_base;
     
     unsigned node_size = fixsize(n);
-    unsigned index = offset + buddy.size - 1;
+    unsigned index = offset + b->size - 1;
     // 如果不是叶子节点，需要向上找到正确的层级
     while (node_size > 1) {
         index = PARENT(index);
         node_size /= 2;
     }
-    assert(buddy.tree[index] == 0); // 确保我们释放的是一个已分配的块
+    assert(b->tree[index] == 0); // 确保我们释放的是一个已分配的块
     
     node_size = fixsize(n);
-    buddy.tree[index] = node_size;
-    
+    b->tree[index] = node_size;
+    nr_free += node_size;
+
+    // 每合并一次，伙伴块不再是独立的空闲块；合并停止处的块计入直方图
+    unsigned merged_size = node_size;
     while (index > 0) {
         index = PARENT(index);
         node_size *= 2;
-        unsigned left = buddy.tree[LEFT_LEAF(index)];
-        unsigned right = buddy.tree[RIGHT_LEAF(index)];
-        if (left + right == node_size)
-            buddy.tree[index] = node_size;
-        else
-            buddy.tree[index] = MAX(left, right);
+        unsigned left = b->tree[LEFT_LEAF(index)];
+        unsigned right = b->tree[RIGHT_LEAF(index)];
+        if (left + right == node_size) {
+            b->tree[index] = node_size;
+            nr_free_blocks[order_of_size(node_size / 2)]--;
+            merged_size = node_size;
+        } else {
+            b->tree[index] = MAX(left, right);
+            break;
+        }
+    }
+    nr_free_blocks[order_of_size(merged_size)]++;
+
+    // 合并停止后，更高层的节点只需要刷新最大值
+    while (index > 0) {
+        index = PARENT(index);
+        b->tree[index] = MAX(b->tree[LEFT_LEAF(index)], b->tree[RIGHT_LEAF(index)]);
     }
     ClearPageProperty(base);
 }
 
 static size_t buddy_nr_free_pages(void) {
-    // This is not a precise count of individual pages, but the size of the largest block
-    if (buddy.tree == NULL) return 0;
-    // A more accurate (but slow) way would be to traverse the tree and sum up free leaves.
-    // For now, this is sufficient for the manager interface's spirit.
-    return buddy.tree[0];
+    return nr_free;
+}
+
+// buddy_nr_free_blocks - 阶为 order 的空闲块个数，O(1)
+size_t buddy_nr_free_blocks(unsigned order) {
+    return order < BUDDY_NR_ORDERS ? nr_free_blocks[order] : 0;
+}
+
+// 空闲块直方图直接来自按阶计数
+static void buddy_stats(struct pmm_stats *st) {
+    for (unsigned o = 0; o < BUDDY_NR_ORDERS; o++)
+        pmm_stats_add_blocks(st, (size_t)1 << o, nr_free_blocks[o]);
+}
+
+// 所有空闲块之和应等于空闲页数
+static size_t buddy_histogram_pages(void) {
+    size_t total = 0;
+    for (unsigned o = 0; o < BUDDY_NR_ORDERS; o++)
+        total += buddy_nr_free_blocks(o) << o;
+    return total;
 }
 
 static void buddy_check(void) {
     cprintf("buddy_check() running (Tree version):\n");
+    assert(nr_trees > 0);
+    size_t total = nr_free_pages();
+    assert(buddy_histogram_pages() == total);
+    // 第一棵树是第一段内存中最大的一棵，小请求都会落在它上面
+    struct Page *page_base = buddy[0].page_base;
 
     struct Page *p1 = alloc_pages(1); assert(p1 != NULL);
     struct Page *p2 = alloc_pages(1); assert(p2 != NULL);
-    cprintf("  Allocated p1(idx %u), p2(idx %u).\n", p1 - buddy.page_base, p2 - buddy.page_base);
-    assert((p1 - buddy.page_base) == 0 && (p2 - buddy.page_base) == 1);
+    cprintf("  Allocated p1(idx %u), p2(idx %u).\n", p1 - page_base, p2 - page_base);
+    assert((p1 - page_base) == 0 && (p2 - page_base) == 1);
 
     struct Page *p3 = alloc_pages(3); assert(p3 != NULL);
-    cprintf("  Allocated p3(3->4 pages) at idx %u.\n", p3 - buddy.page_base);
-    assert((p3 - buddy.page_base) == 4);
+    cprintf("  Allocated p3(3->4 pages) at idx %u.\n", p3 - page_base);
+    assert((p3 - page_base) == 4);
+    assert(nr_free_pages() == total - 6);
+    assert(buddy_histogram_pages() == total - 6);
+    // 第 0、1 页已分配，第 2~3 页是阶 1 的空闲块
+    assert(buddy_nr_free_blocks(1) >= 1);
 
     cprintf("  Freeing p1 and p2...\n");
     free_pages(p1, 1);
     free_pages(p2, 1);
     
     p1 = alloc_pages(2); assert(p1 != NULL);
-    cprintf("  Re-allocated 2 pages, got idx %u.\n", p1 - buddy.page_base);
-    assert((p1 - buddy.page_base) == 0);
+    cprintf("  Re-allocated 2 pages, got idx %u.\n", p1 - page_base);
+    assert((p1 - page_base) == 0);
 
     // Cleanup
     free_pages(p1, 2);
     free_pages(p3, 3);
 
-    size_t final_free = nr_free_pages();
-    assert(final_free == buddy.size);
-    cprintf("  Final check: Total free block size matches managed size (%u).\n", final_free);
+    assert(buddy[0].tree[0] == buddy[0].size);
+    assert(nr_free_pages() == total);
+    assert(buddy_histogram_pages() == total);
+    cprintf("  Final check: %u free pages, tree 0 is fully free again.\n", total);
+
+    // 第一棵树用满后，请求继续由后面的树满足
+    if (nr_trees > 1) {
+        p1 = alloc_pages(buddy[0].size);
+        assert(p1 == page_base);
+        p2 = alloc_page();
+        assert(p2 != NULL && buddy_tree_of(p2) != &buddy[0]);
+        cprintf("  Tree 0 full, next page came from another tree.\n");
+        free_page(p2);
+        free_pages(p1, buddy[0].size);
+    }
+
+    pmm_bench();
 
     cprintf("Buddy system (Tree version) check passed!\n");
 }
@@ -201,4 +395,6 @@ const struct pmm_manager buddy_pmm_manager = {
     .free_pages = buddy_free_pages,
     .nr_free_pages = buddy_nr_free_pages,
     .check = buddy_check,
+    .stats = buddy_stats,
+    .alloc_pages_aligned = buddy_alloc_pages_aligned,
 };
\ No newline at end of file
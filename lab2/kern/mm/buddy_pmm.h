@@ -4,6 +4,11 @@
 
 #include <pmm.h>
 
+// 空闲块直方图覆盖的阶数 (树大小为 unsigned)
+#define BUDDY_NR_ORDERS     32
+
 extern const struct pmm_manager buddy_pmm_manager;
 
+size_t buddy_nr_free_blocks(unsigned order);
+
 #endif /* ! __KERN_MM_BUDDY_PMM_H__ */
\ No newline at end of file
@@ -74,8 +74,7 @@ default_init_memmap(struct Page *base, size_t n) {
         p->flags = p->property = 0;
         set_page_ref(p, 0);
     }
-    base->property = n;
-    SetPageProperty(base);
+    set_block_tags(base, n);
     nr_free += n;
     if (list_empty(&free_list)) {
         list_add(&free_list, &(base->page_link));
@@ -113,8 +112,7 @@ default_alloc_pages(size_t n) {
         list_del(&(page->page_link));
         if (page->property > n) {
             struct Page *p = page + n;
-            p->property = page->property - n;
-            SetPageProperty(p);
+            set_block_tags(p, page->property - n);
             list_add(prev, &(p->page_link));
         }
         nr_free -= n;
@@ -123,6 +121,45 @@ default_alloc_pages(size_t n) {
     return page;
 }
 
+// carve_block - allocate [base, base + n) from inside the free block; what
+// is left before and after it stays free, in the block's place in the list
+static void
+carve_block(struct Page *block, struct Page *base, size_t n) {
+    struct Page *end = block + block->property;
+    list_entry_t *prev = list_prev(&(block->page_link));
+    list_del(&(block->page_link));
+    ClearPageProperty(block);
+    if (base + n < end) {
+        set_block_tags(base + n, end - (base + n));
+        list_add(prev, &(base[n].page_link));
+    }
+    if (base > block) {
+        set_block_tags(block, base - block);
+        list_add(prev, &(block->page_link));
+    }
+    nr_free -= n;
+}
+
+// default_alloc_pages_aligned - first fit over the free blocks that hold n
+// pages starting at a page number that is a multiple of align
+static struct Page *
+default_alloc_pages_aligned(size_t n, size_t align) {
+    assert(n > 0 && (align & (align - 1)) == 0);
+    if (n > nr_free) {
+        return NULL;
+    }
+    list_entry_t *le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        struct Page *p = le2page(le, page_link);
+        struct Page *base = p + (ROUNDUP(page2ppn(p), align) - page2ppn(p));
+        if (base + n <= p + p->property) {
+            carve_block(p, base, n);
+            return base;
+        }
+    }
+    return NULL;
+}
+
 static void
 default_free_pages(struct Page *base, size_t n) {
     assert(n > 0);
@@ -132,45 +169,37 @@ default_free_pages(struct Page *base, size_t n) {
         p->flags = 0;
         set_page_ref(p, 0);
     }
-    base->property = n;
-    SetPageProperty(base);
     nr_free += n;
 
-    if (list_empty(&free_list)) {
-        list_add(&free_list, &(base->page_link));
-    } else {
-        list_entry_t* le = &free_list;
-        while ((le = list_next(le)) != &free_list) {
-            struct Page* page = le2page(le, page_link);
-            if (base < page) {
-                list_add_before(le, &(base->page_link));
-                break;
-            } else if (list_next(le) == &free_list) {
-                list_add(le, &(base->page_link));
-            }
-        }
+    // find the physical neighbours through the boundary tags; a merged block
+    // takes over the list position of the neighbour it absorbs, so the list
+    // stays address ordered without being walked
+    struct Page *prev = prev_free_block(base);
+    struct Page *next = next_free_block(base, n);
+    if (prev != NULL) {
+        n += prev->property;
+        base = prev;
+    } else if (next != NULL) {
+        list_add_before(&(next->page_link), &(base->page_link));
     }
-
-    list_entry_t* le = list_prev(&(base->page_link));
-    if (le != &free_list) {
-        p = le2page(le, page_link);
-        if (p + p->property == base) {
-            p->property += base->property;
-            ClearPageProperty(base);
-            list_del(&(base->page_link));
-            base = p;
-        }
+    if (next != NULL) {
+        n += next->property;
+        ClearPageProperty(next);
+        list_del(&(next->page_link));
+    }
+    set_block_tags(base, n);
+    if (prev != NULL || next != NULL) {
+        return;
     }
 
-    le = list_next(&(base->page_link));
-    if (le != &free_list) {
-        p = le2page(le, page_link);
-        if (base + base->property == p) {
-            base->property += p->property;
-            ClearPageProperty(p);
-            list_del(&(p->page_link));
+    // no free neighbour: first fit needs the address order, so search for it
+    list_entry_t* le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        if (base < le2page(le, page_link)) {
+            break;
         }
     }
+    list_add_before(le, &(base->page_link));
 }
 
 static size_t
@@ -178,6 +207,42 @@ default_nr_free_pages(void) {
     return nr_free;
 }
 
+static void
+default_stats(struct pmm_stats *st) {
+    list_entry_t *le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        pmm_stats_add_blocks(st, le2page(le, page_link)->property, 1);
+    }
+}
+
+// hold_free_blocks - allocate every free block whole, chained on held through
+// page_link, so the checks below see an empty manager. Merging follows the
+// physical neighbours, so the free blocks must really be taken rather than
+// just unlinked from free_list.
+static void
+hold_free_blocks(list_entry_t *held) {
+    list_init(held);
+    while (!list_empty(&free_list)) {
+        struct Page *p = le2page(list_next(&free_list), page_link);
+        size_t n = p->property;
+        assert(alloc_pages(n) == p);
+        p->property = n;
+        list_add_before(held, &(p->page_link));
+    }
+    assert(nr_free == 0);
+}
+
+// release_free_blocks - give back everything hold_free_blocks took
+static void
+release_free_blocks(list_entry_t *held) {
+    while (!list_empty(held)) {
+        list_entry_t *le = list_next(held);
+        list_del(le);
+        struct Page *p = le2page(le, page_link);
+        free_pages(p, p->property);
+    }
+}
+
 static void
 basic_check(void) {
     struct Page *p0, *p1, *p2;
@@ -193,13 +258,10 @@ basic_check(void) {
     assert(page2pa(p1) < npage * PGSIZE);
     assert(page2pa(p2) < npage * PGSIZE);
 
-    list_entry_t free_list_store = free_list;
-    list_init(&free_list);
+    list_entry_t held;
+    hold_free_blocks(&held);
     assert(list_empty(&free_list));
 
-    unsigned int nr_free_store = nr_free;
-    nr_free = 0;
-
     assert(alloc_page() == NULL);
 
     free_page(p0);
@@ -221,8 +283,7 @@ basic_check(void) {
     assert(alloc_page() == NULL);
 
     assert(nr_free == 0);
-    free_list = free_list_store;
-    nr_free = nr_free_store;
+    release_free_blocks(&held);
 
     free_page(p);
     free_page(p1);
@@ -248,14 +309,11 @@ default_check(void) {
     assert(p0 != NULL);
     assert(!PageProperty(p0));
 
-    list_entry_t free_list_store = free_list;
-    list_init(&free_list);
+    list_entry_t held;
+    hold_free_blocks(&held);
     assert(list_empty(&free_list));
     assert(alloc_page() == NULL);
 
-    unsigned int nr_free_store = nr_free;
-    nr_free = 0;
-
     free_pages(p0 + 2, 3);
     assert(alloc_pages(4) == NULL);
     assert(PageProperty(p0 + 2) && p0[2].property == 3);
@@ -280,9 +338,7 @@ default_check(void) {
     assert(alloc_page() == NULL);
 
     assert(nr_free == 0);
-    nr_free = nr_free_store;
-
-    free_list = free_list_store;
+    release_free_blocks(&held);
     free_pages(p0, 5);
 
     le = &free_list;
@@ -302,5 +358,7 @@ const struct pmm_manager default_pmm_manager = {
     .free_pages = default_free_pages,
     .nr_free_pages = default_nr_free_pages,
     .check = default_check,
+    .stats = default_stats,
+    .alloc_pages_aligned = default_alloc_pages_aligned,
 };
 
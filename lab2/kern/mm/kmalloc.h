@@ -0,0 +1,48 @@
+#ifndef __KERN_MM_KMALLOC_H__
+#define __KERN_MM_KMALLOC_H__
+
+#include <defs.h>
+
+/* *
+ * General purpose kernel heap on top of the SLUB object caches in slub_pmm.c.
+ * Requests up to SLUB_MAX_SIZE bytes come from the size-class caches, larger
+ * ones take whole pages from the active pmm_manager; either way kfree and
+ * ksize find their way back through struct Page. Usable once pmm_init has
+ * called kmem_init.
+ * */
+
+#define KM_ZERO             0x1     // zero the returned memory
+
+#define CACHE_LINE_SIZE     64      // align argument for hot, per-object data
+
+void kmem_init(void);
+
+void *kmalloc(size_t size, unsigned int flags);
+void kfree(void *ptr);
+size_t ksize(void *ptr);
+
+/* *
+ * Named object caches: objects of exactly one size, packed at the given
+ * alignment (0 means pointer alignment). A non-NULL ctor runs once per
+ * object when its slab is created, and objects should be freed back in
+ * their constructed state, so callers can skip re-initialising them.
+ * */
+typedef struct kmem_cache_s kmem_cache_t;
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *));
+void kmem_cache_destroy(kmem_cache_t *cache);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/* *
+ * Empty slabs stay cached for reuse. kmem_cache_shrink gives back all but
+ * the cache's min_free of them and returns the number of pages released;
+ * kmem_shrink_all does that for every cache and is called by alloc_pages
+ * when free memory runs low.
+ * */
+size_t kmem_cache_shrink(kmem_cache_t *cache);
+size_t kmem_shrink_all(void);
+size_t kmem_nr_cached_pages(void);   // pages in empty slabs
+
+#endif /* !__KERN_MM_KMALLOC_H__ */
@@ -32,15 +32,23 @@ typedef uintptr_t pde_t;
  * that convert Page to other data types, such as physical address.
  * */
 struct Page {
-    int ref;                        // page frame's reference counter
     uint64_t flags;                 // array of flags that describe the status of the page frame
+    int ref;                        // page frame's reference counter
     unsigned int property;          // the num of free block, used in first fit pm manager
-    list_entry_t page_link;         // free list link
+    union {
+        list_entry_t page_link;     // free list link
+        void *slab;                 // PG_slab pages: descriptor of the slab they belong to
+    };
 };
 
+// the fields above are ordered so that struct Page has no padding: 32 bytes,
+// two descriptors per 64-byte cache line (checked in page_init)
+#define PAGE_DESC_MAX               32
+
 /* Flags describing the status of a page frame */
 #define PG_reserved                 0       // if this bit=1: the Page is reserved for kernel, cannot be used in alloc/free_pages; otherwise, this bit=0 
 #define PG_property                 1       // if this bit=1: the Page is the head page of a free memory block(contains some continuous_addrress pages), and can be used in alloc_pages; if this bit=0: if the Page is the the head page of a free memory block, then this Page and the memory block is alloced. Or this Page isn't the head page.
+#define PG_slab                     2       // if this bit=1: the Page holds a slab of the SLUB object allocator; objects in it are freed back to the slab
 
 #define SetPageReserved(page)       ((page)->flags |= (1UL << PG_reserved))
 #define ClearPageReserved(page)     ((page)->flags &= ~(1UL << PG_reserved))
@@ -48,6 +56,9 @@ struct Page {
 #define SetPageProperty(page)       ((page)->flags |= (1UL << PG_property))
 #define ClearPageProperty(page)     ((page)->flags &= ~(1UL << PG_property))
 #define PageProperty(page)          (((page)->flags >> PG_property) & 1)
+#define SetPageSlab(page)           ((page)->flags |= (1UL << PG_slab))
+#define ClearPageSlab(page)         ((page)->flags &= ~(1UL << PG_slab))
+#define PageSlab(page)              (((page)->flags >> PG_slab) & 1)
 
 // convert list entry to page
 #define le2page(le, member)                 \
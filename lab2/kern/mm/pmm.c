@@ -1,7 +1,11 @@
 #include <default_pmm.h>
 #include <best_fit_pmm.h>
+#include <best_fit_seg_pmm.h>
 #include <slub_pmm.h>
+#include <kmalloc.h>
 #include <buddy_pmm.h>
+#include <buddy_list_pmm.h>
+#include <bitmap_pmm.h>
 #include <defs.h>
 #include <error.h>
 #include <memlayout.h>
@@ -33,12 +37,44 @@ const struct pmm_manager *pmm_manager;
 
 
 static void check_alloc_page(void);
+static void check_alloc_aligned(void);
+static void check_kmalloc(void);
 
-// init_pmm_manager - initialize a pmm_manager instance
+// pmm_managers - every manager built into the kernel, keyed by the name that
+// selects it with "pmm=<name>" in /chosen/bootargs; the first is the default
+static const struct {
+    const char *name;
+    const struct pmm_manager *manager;
+} pmm_managers[] = {
+    {"best_fit", &best_fit_pmm_manager},
+    {"default", &default_pmm_manager},
+    {"best_fit_seg", &best_fit_seg_pmm_manager},
+    {"buddy", &buddy_pmm_manager},
+    {"buddy_list", &buddy_list_pmm_manager},
+    {"slub", &slub_pmm_manager},
+    {"bitmap", &bitmap_pmm_manager},
+};
+
+// init_pmm_manager - initialize the pmm_manager chosen on the command line
 static void init_pmm_manager(void) {
-    //pmm_manager = &best_fit_pmm_manager;
-    //pmm_manager = &slub_pmm_manager;
-    pmm_manager = &best_fit_pmm_manager;
+    const size_t nmanagers = sizeof(pmm_managers) / sizeof(pmm_managers[0]);
+    size_t len;
+    const char *want = get_bootarg("pmm", &len);
+    pmm_manager = pmm_managers[0].manager;
+    if (want != NULL) {
+        size_t i;
+        for (i = 0; i < nmanagers; i ++) {
+            if (strlen(pmm_managers[i].name) == len &&
+                strncmp(pmm_managers[i].name, want, len) == 0) {
+                pmm_manager = pmm_managers[i].manager;
+                break;
+            }
+        }
+        if (i == nmanagers) {
+            cprintf("unknown pmm=%.*s, using %s\n", (int)len, want,
+                    pmm_managers[0].name);
+        }
+    }
     cprintf("memory management: %s\n", pmm_manager->name);
     pmm_manager->init();
 }
@@ -48,14 +84,131 @@ static void init_memmap(struct Page *base, size_t n) {
     pmm_manager->init_memmap(base, n);
 }
 
+// when free pages drop below KMEM_SHRINK_LOW, alloc_pages asks the slab caches
+// to give back their empty slabs; it asks again only after free memory has
+// climbed back to KMEM_SHRINK_HIGH, so a low-memory stretch costs one pass
+#define KMEM_SHRINK_LOW     256
+#define KMEM_SHRINK_HIGH    (2 * KMEM_SHRINK_LOW)
+
+static bool kmem_shrunk;    // shrunk since free pages last reached KMEM_SHRINK_HIGH
+
+#ifdef PMM_TRACE
+/* *
+ * Alloc/free trace, built in with "make DEFS=-DPMM_TRACE". Each successful
+ * alloc_pages and each free_pages writes one record into a ring holding the
+ * last PMM_TRACE_SIZE calls; pmm_trace_dump prints the ring in the format
+ * that tools/bench replays.
+ * */
+#define PMM_TRACE_SIZE      4096    // records, a power of two
+
+struct pmm_trace_entry {
+    uint64_t time;      // rdtime at the call
+    uintptr_t ra;       // return address of the caller
+    uint32_t ppn;       // first frame of the block
+    uint32_t n : 31;    // number of pages
+    uint32_t free : 1;
+};
+
+static struct pmm_trace_entry pmm_trace_ring[PMM_TRACE_SIZE];
+static size_t pmm_trace_count;      // records ever written
+
+static inline void pmm_trace(int free, struct Page *base, size_t n, uintptr_t ra) {
+    struct pmm_trace_entry *e = &pmm_trace_ring[pmm_trace_count ++ & (PMM_TRACE_SIZE - 1)];
+    e->time = rdtime();
+    e->ra = ra;
+    e->ppn = page2ppn(base);
+    e->n = n;
+    e->free = free;
+}
+
+#define PMM_TRACE_CALL(free, base, n) \
+    pmm_trace(free, base, n, (uintptr_t)__builtin_return_address(0))
+
+// pmm_trace_dump - print the ring oldest first, one "op ppn n time ra" line
+// per record in hex; frees of blocks allocated before the oldest record are
+// skipped on replay
+void pmm_trace_dump(void) {
+    size_t first = pmm_trace_count > PMM_TRACE_SIZE ? pmm_trace_count - PMM_TRACE_SIZE : 0;
+    cprintf("# pmm trace: %s, %lu of %lu records\n", pmm_manager->name,
+            pmm_trace_count - first, pmm_trace_count);
+    for (size_t i = first; i < pmm_trace_count; i ++) {
+        struct pmm_trace_entry *e = &pmm_trace_ring[i & (PMM_TRACE_SIZE - 1)];
+        cprintf("%c %x %x %lx %lx\n", e->free ? 'f' : 'a', e->ppn, e->n,
+                e->time, e->ra);
+    }
+}
+#else
+#define PMM_TRACE_CALL(free, base, n) do { } while (0)
+#endif
+
+// manager_alloc_pages - n pages from pmm_manager, the first page number a
+// multiple of align. A manager without an aligned search of its own is asked
+// for a run long enough to hold an aligned one and the ends are given back;
+// such managers all accept frees of part of a block.
+static struct Page *manager_alloc_pages(size_t n, size_t align) {
+    if (align <= 1) {
+        return pmm_manager->alloc_pages(n);
+    }
+    if (pmm_manager->alloc_pages_aligned != NULL) {
+        return pmm_manager->alloc_pages_aligned(n, align);
+    }
+    struct Page *page = pmm_manager->alloc_pages(n + align - 1);
+    if (page == NULL) {
+        return NULL;
+    }
+    size_t head = ROUNDUP(page2ppn(page), align) - page2ppn(page);
+    if (head > 0) {
+        pmm_manager->free_pages(page, head);
+    }
+    if (align - 1 - head > 0) {
+        pmm_manager->free_pages(page + head + n, align - 1 - head);
+    }
+    return page + head;
+}
+
+static inline struct Page *__alloc_pages(size_t n, size_t align) {
+    struct Page *page = manager_alloc_pages(n, align);
+    if (page == NULL) {
+        // empty slabs may be holding the memory, retry once after shrinking
+        if (kmem_shrink_all() > 0) {
+            page = manager_alloc_pages(n, align);
+        }
+    } else {
+        size_t nr_free = nr_free_pages();
+        if (nr_free < KMEM_SHRINK_LOW && !kmem_shrunk) {
+            kmem_shrunk = 1;
+            kmem_shrink_all();
+        } else if (nr_free >= KMEM_SHRINK_HIGH) {
+            kmem_shrunk = 0;
+        }
+    }
+    return page;
+}
+
 // alloc_pages - call pmm->alloc_pages to allocate a continuous n*PAGESIZE
 // memory
 struct Page *alloc_pages(size_t n) {
-    return pmm_manager->alloc_pages(n);
+    struct Page *page = __alloc_pages(n, 1);
+    if (page != NULL) {
+        PMM_TRACE_CALL(0, page, n);
+    }
+    return page;
+}
+
+// alloc_pages_aligned - like alloc_pages, with the physical address of the
+// first page a multiple of align pages, e.g. 512 for an Sv39 megapage
+struct Page *alloc_pages_aligned(size_t n, size_t align) {
+    assert(align > 0 && (align & (align - 1)) == 0);
+    struct Page *page = __alloc_pages(n, align);
+    if (page != NULL) {
+        PMM_TRACE_CALL(0, page, n);
+    }
+    return page;
 }
 
 // free_pages - call pmm->free_pages to free a continuous n*PAGESIZE memory
 void free_pages(struct Page *base, size_t n) {
+    PMM_TRACE_CALL(1, base, n);
     pmm_manager->free_pages(base, n);
 }
 
@@ -65,6 +218,86 @@ size_t nr_free_pages(void) {
     return pmm_manager->nr_free_pages();
 }
 
+// pmm_get_stats - fill st from the manager's stats hook, with the pages in
+// empty slabs as cached; returns 0 if the manager has no hook
+bool pmm_get_stats(struct pmm_stats *st) {
+    memset(st, 0, sizeof(*st));
+    if (pmm_manager->stats == NULL) {
+        return 0;
+    }
+    pmm_manager->stats(st);
+    st->cached = kmem_nr_cached_pages();
+    st->frag = st->nr_free ? (st->nr_free - st->largest) * 1000 / st->nr_free : 0;
+    return 1;
+}
+
+// print_pmm_stats - print free memory, the free block histogram and the
+// external fragmentation index of the current pmm_manager
+void print_pmm_stats(void) {
+    struct pmm_stats st;
+    if (!pmm_get_stats(&st)) {
+        cprintf("%s keeps no free block statistics\n", pmm_manager->name);
+        return;
+    }
+    cprintf("%s: %lu free pages (+%lu cached), largest block %lu, "
+            "fragmentation %u/1000\n", pmm_manager->name, st.nr_free,
+            st.cached, st.largest, st.frag);
+    cprintf("  free blocks by order:");
+    for (unsigned int k = 0; k < PMM_STATS_ORDERS; k ++) {
+        if (st.nr_blocks[k] != 0) {
+            cprintf(" %u:%lu", k, st.nr_blocks[k]);
+        }
+    }
+    cprintf("\n");
+}
+
+#define PMM_BENCH_BATCH     256
+#define PMM_BENCH_ROUNDS    16
+
+/* *
+ * pmm_bench - run the same alloc/free workload against whichever pmm_manager
+ * is active and report the average cost in rdtime ticks, so the check() hooks
+ * of different managers can be compared on one kernel image.
+ * */
+void pmm_bench(void) {
+    static struct Page *bench_pages[PMM_BENCH_BATCH];
+    static const size_t bench_sizes[] = {1, 2, 1, 4, 1, 3, 1, 8};
+    const size_t nsizes = sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+    size_t free_before = nr_free_pages();
+    uint64_t start, single_ticks, mixed_ticks;
+
+    // order-0 bursts: a batch of single pages, freed in reverse
+    start = rdtime();
+    for (int r = 0; r < PMM_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < PMM_BENCH_BATCH; i++) {
+            assert((bench_pages[i] = alloc_page()) != NULL);
+        }
+        for (int i = PMM_BENCH_BATCH - 1; i >= 0; i--) {
+            free_page(bench_pages[i]);
+        }
+    }
+    single_ticks = rdtime() - start;
+
+    // mixed small sizes, freed in allocation order
+    start = rdtime();
+    for (int r = 0; r < PMM_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < PMM_BENCH_BATCH; i++) {
+            assert((bench_pages[i] = alloc_pages(bench_sizes[i % nsizes])) != NULL);
+        }
+        for (int i = 0; i < PMM_BENCH_BATCH; i++) {
+            free_pages(bench_pages[i], bench_sizes[i % nsizes]);
+        }
+    }
+    mixed_ticks = rdtime() - start;
+
+    assert(nr_free_pages() == free_before);
+    cprintf("pmm_bench(%s):\n", pmm_manager->name);
+    cprintf("  order-0 alloc+free: %lu ticks/op\n",
+            single_ticks / (PMM_BENCH_ROUNDS * PMM_BENCH_BATCH));
+    cprintf("  mixed   alloc+free: %lu ticks/op\n",
+            mixed_ticks / (PMM_BENCH_ROUNDS * PMM_BENCH_BATCH));
+}
+
 static void page_init(void) {
     va_pa_offset = PHYSICAL_MEMORY_OFFSET;
 
@@ -87,6 +320,9 @@ static void page_init(void) {
 
     extern char end[];
 
+    static_assert(sizeof(struct Page) <= PAGE_DESC_MAX);
+    static_assert(PGSIZE % sizeof(struct Page) == 0);
+
     npage = maxpa / PGSIZE;
     //kernel在end[]结束, pages是剩下的页的开始
     pages = (struct Page *)ROUNDUP((void *)end, PGSIZE);
@@ -117,8 +353,18 @@ void pmm_init(void) {
     // then use pmm->init_memmap to create free page list
     page_init();
 
+    // the kernel heap takes its pages from pmm_manager, so it can start now
+    kmem_init();
+
     // use pmm->check to verify the correctness of the alloc/free function in a pmm
     check_alloc_page();
+    check_alloc_aligned();
+    check_kmalloc();
+    print_pmm_stats();
+
+#ifdef PMM_TRACE
+    pmm_trace_dump();
+#endif
 
     extern char boot_page_table_sv39[];
     satp_virtual = (pte_t*)boot_page_table_sv39;
@@ -130,3 +376,143 @@ static void check_alloc_page(void) {
     pmm_manager->check();
     cprintf("check_alloc_page() succeeded!\n");
 }
+
+// check_alloc_aligned - aligned runs of several sizes, taken while a single
+// page is held so that free memory does not start out aligned
+static void check_alloc_aligned(void) {
+    static const size_t tests[][2] = {{1, 2}, {3, 16}, {16, 16}, {5, 512}, {512, 512}};
+    const size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    struct Page *p[sizeof(tests) / sizeof(tests[0])];
+    size_t nr_free_store = nr_free_pages();
+    struct Page *one = alloc_page();
+    assert(one != NULL);
+    for (size_t i = 0; i < ntests; i ++) {
+        size_t n = tests[i][0], align = tests[i][1], before = nr_free_pages();
+        assert((p[i] = alloc_pages_aligned(n, align)) != NULL);
+        assert(page2ppn(p[i]) % align == 0 && nr_free_pages() <= before - n);
+        for (size_t j = 0; j < i; j ++) {
+            assert(p[j] + tests[j][0] <= p[i] || p[i] + n <= p[j]);
+        }
+    }
+    for (size_t i = 0; i < ntests; i ++) {
+        free_pages(p[i], tests[i][0]);
+    }
+    free_page(one);
+    assert(nr_free_pages() == nr_free_store);
+    cprintf("check_alloc_aligned() succeeded!\n");
+}
+
+#define CHECK_OBJ_MAGIC     0x6b6d656dUL
+
+struct check_obj {
+    uint64_t magic;
+    char payload[32];
+};
+
+static void check_obj_ctor(void *obj) {
+    ((struct check_obj *)obj)->magic = CHECK_OBJ_MAGIC;
+}
+
+static void check_kmalloc(void) {
+    // small objects come from the size classes and may be rounded up
+    char *a = kmalloc(24, 0), *b = kmalloc(24, KM_ZERO);
+    assert(a != NULL && b != NULL && a != b);
+    assert(ksize(a) >= 24 && ksize(a) < PGSIZE);
+    for (int i = 0; i < 24; i++) {
+        assert(b[i] == 0);
+    }
+    memset(a, 0x5a, ksize(a));
+
+    // large ones take whole pages, tracked in their struct Page
+    size_t nr_free_store = nr_free_pages();
+    char *big = kmalloc(3 * PGSIZE + 1, 0);
+    assert(big != NULL && ksize(big) == 4 * PGSIZE);
+    struct Page *page = pa2page(PADDR(big));
+    assert(!PageSlab(page) && page->property == 4);
+    memset(big, 0xa5, 3 * PGSIZE + 1);
+
+    kfree(big);
+    assert(nr_free_pages() == nr_free_store);
+    kfree(b);
+    kfree(a);
+    kfree(NULL);
+    assert(kmalloc(0, 0) == NULL && ksize(NULL) == 0);
+
+    // 2048-byte objects keep their slab_t off-slab, so two share a page
+    char *half[3];
+    for (int i = 0; i < 3; i++) {
+        assert((half[i] = kmalloc(2048, 0)) != NULL && ksize(half[i]) == 2048);
+    }
+    assert(ROUNDDOWN(half[0], PGSIZE) == ROUNDDOWN(half[1], PGSIZE) ||
+           ROUNDDOWN(half[1], PGSIZE) == ROUNDDOWN(half[2], PGSIZE));
+    for (int i = 0; i < 3; i++) {
+        kfree(half[i]);
+    }
+
+    // a named cache packs 40-byte objects on cache-line boundaries, and the
+    // constructed state survives a free/alloc round trip
+    kmem_cache_t *cache = kmem_cache_create("check_obj", sizeof(struct check_obj),
+                                            CACHE_LINE_SIZE, check_obj_ctor);
+    assert(cache != NULL);
+    nr_free_store = nr_free_pages();
+    struct check_obj *objs[80];
+    for (int i = 0; i < 80; i++) {
+        assert((objs[i] = kmem_cache_alloc(cache)) != NULL);
+        assert(((uintptr_t)objs[i] & (CACHE_LINE_SIZE - 1)) == 0);
+        assert(objs[i]->magic == CHECK_OBJ_MAGIC && ksize(objs[i]) == sizeof(struct check_obj));
+        memset(objs[i]->payload, i, sizeof(objs[i]->payload));
+    }
+    for (int i = 0; i < 80; i++) {
+        kmem_cache_free(cache, objs[i]);
+    }
+    for (int i = 0; i < 80; i++) {
+        assert((objs[i] = kmem_cache_alloc(cache)) != NULL);
+        assert(objs[i]->magic == CHECK_OBJ_MAGIC);
+    }
+    for (int i = 0; i < 80; i++) {
+        kmem_cache_free(cache, objs[i]);
+    }
+    // the descriptor is kmalloc'ed, but the slab pages all go back
+    kmem_cache_destroy(cache);
+    assert(nr_free_pages() == nr_free_store);
+
+    // 1500-byte objects waste too much in one page and get multi-page slabs;
+    // objects beyond the first page must still find their slab
+    cache = kmem_cache_create("check_1500", 1500, 0, NULL);
+    assert(cache != NULL);
+    nr_free_store = nr_free_pages();
+    char *mid[12];
+    for (int i = 0; i < 12; i++) {
+        assert((mid[i] = kmem_cache_alloc(cache)) != NULL && ksize(mid[i]) == 1500);
+        memset(mid[i], i, 1500);
+    }
+    // a fresh cache fills one slab in address order
+    assert(mid[11] >= mid[0] + 2 * PGSIZE);
+    for (int i = 0; i < 12; i++) {
+        kmem_cache_free(cache, mid[i]);
+    }
+    kmem_cache_destroy(cache);
+    assert(nr_free_pages() == nr_free_store);
+
+    // emptied slabs stay cached until a shrink hands all but one back
+    cache = kmem_cache_create("check_shrink", 1024, 0, NULL);
+    assert(cache != NULL);
+    nr_free_store = nr_free_pages();
+    char *objs_1k[16];
+    for (int i = 0; i < 16; i++) {
+        assert((objs_1k[i] = kmem_cache_alloc(cache)) != NULL);
+    }
+    for (int i = 0; i < 16; i++) {
+        kmem_cache_free(cache, objs_1k[i]);
+    }
+    assert(nr_free_pages() == nr_free_store - 4);
+    // the hart's active slab, if it has one, is not cached and stays
+    size_t cached = kmem_nr_cached_pages(), freed = kmem_cache_shrink(cache);
+    assert(freed >= 2 && freed <= 3 && kmem_cache_shrink(cache) == 0);
+    assert(kmem_nr_cached_pages() == cached - freed);
+    assert(nr_free_pages() == nr_free_store - 4 + freed);
+    kmem_cache_destroy(cache);
+    assert(nr_free_pages() == nr_free_store);
+    kmem_shrink_all();
+    cprintf("check_kmalloc() succeeded!\n");
+}
@@ -7,6 +7,18 @@
 #include <mmu.h>
 #include <riscv.h>
 
+#define PMM_STATS_ORDERS    32
+
+// pmm_stats - a snapshot of free memory, see pmm_get_stats
+struct pmm_stats {
+    size_t nr_free;                         // free pages in the manager's blocks
+    size_t nr_blocks[PMM_STATS_ORDERS];     // free blocks of [2^k, 2^(k+1)) pages
+    size_t largest;                         // pages in the largest free block
+    size_t cached;                          // free pages held in caches outside them
+    unsigned int frag;                      // share of nr_free outside the largest
+                                            // block, in 1/1000
+};
+
 // pmm_manager is a physical memory management class. A special pmm manager -
 // XXX_pmm_manager
 // only needs to implement the methods in pmm_manager class, then
@@ -29,6 +41,11 @@ struct pmm_manager {
                                                       // structures(memlayout.h)
     size_t (*nr_free_pages)(void);  // return the number of free pages
     void (*check)(void);            // check the correctness of XXX_pmm_manager
+    void (*stats)(struct pmm_stats *st);  // optional: report every free block
+                                          // with pmm_stats_add_blocks
+    struct Page *(*alloc_pages_aligned)(
+        size_t n, size_t align);  // optional: n pages whose first page number
+                                  // is a multiple of align (a power of two)
 };
 
 extern const struct pmm_manager *pmm_manager;
@@ -36,9 +53,30 @@ extern const struct pmm_manager *pmm_manager;
 void pmm_init(void);
 
 struct Page *alloc_pages(size_t n);
+struct Page *alloc_pages_aligned(size_t n, size_t align); // align in pages
 void free_pages(struct Page *base, size_t n);
 size_t nr_free_pages(void); // number of free pages
 
+// pmm_stats_add_blocks - account count free blocks of n pages each
+static inline void pmm_stats_add_blocks(struct pmm_stats *st, size_t n, size_t count) {
+    unsigned int k = 0;
+    while (k + 1 < PMM_STATS_ORDERS && (n >> (k + 1)) != 0) {
+        k ++;
+    }
+    st->nr_blocks[k] += count;
+    st->nr_free += n * count;
+    if (count > 0 && n > st->largest) {
+        st->largest = n;
+    }
+}
+
+bool pmm_get_stats(struct pmm_stats *st);
+void print_pmm_stats(void);
+void pmm_bench(void);       // time a fixed alloc/free workload on pmm_manager
+#ifdef PMM_TRACE
+void pmm_trace_dump(void);  // print the recorded alloc/free calls
+#endif
+
 #define alloc_page() alloc_pages(1)
 #define free_page(page) free_pages(page, 1)
 
@@ -51,6 +89,10 @@ size_t nr_free_pages(void); // number of free pages
  * corresponding physical address.  It panics if you pass it a non-kernel
  * virtual address.
  * */
+#ifdef PMM_HOST
+// the host-side benchmark backs physical memory with a buffer below KERNBASE
+#define PADDR(kva) ((uintptr_t)(kva) - va_pa_offset)
+#else
 #define PADDR(kva)                                                 \
     ({                                                             \
         uintptr_t __m_kva = (uintptr_t)(kva);                      \
@@ -59,6 +101,7 @@ size_t nr_free_pages(void); // number of free pages
         }                                                          \
         __m_kva - va_pa_offset;                                    \
     })
+#endif
 
 /* *
  * KADDR - takes a physical address and returns the corresponding kernel virtual
@@ -107,6 +150,45 @@ static inline struct Page *pa2page(uintptr_t pa) {
     }
     return &pages[PPN(pa) - nbase];
 }
+
+/* *
+ * Boundary tags - a free block of n pages has PG_property set on its head
+ * page, and property = n on both its head and its last page. Given a block
+ * [base, base + n) that is being freed, the free blocks physically next to
+ * it can then be found in O(1), without walking any free list.
+ * */
+static inline void set_block_tags(struct Page *base, size_t n) {
+    base->property = n;
+    base[n - 1].property = n;
+    SetPageProperty(base);
+}
+
+// next_free_block - the free block starting right after [base, base + n)
+static inline struct Page *next_free_block(struct Page *base, size_t n) {
+    struct Page *next = base + n;
+    if (next < pages + (npage - nbase) && PageProperty(next)) {
+        return next;
+    }
+    return NULL;
+}
+
+// prev_free_block - the free block ending right before base. The tail's
+// property may be stale if that page is not free, so the head it points
+// to must agree on the size.
+static inline struct Page *prev_free_block(struct Page *base) {
+    if (base <= pages) {
+        return NULL;
+    }
+    struct Page *tail = base - 1;
+    if (tail->property == 0 || tail->property > tail - pages + 1) {
+        return NULL;
+    }
+    struct Page *head = tail - tail->property + 1;
+    if (PageProperty(head) && head->property == tail->property) {
+        return head;
+    }
+    return NULL;
+}
 static inline void flush_tlb() { asm volatile("sfence.vm"); }
 extern char bootstack[], bootstacktop[]; // defined in entry.S
 
@@ -3,15 +3,23 @@
 #include <list.h>
 #include <string.h>
 #include <slub_pmm.h>
+#include <kmalloc.h>
 #include <stdio.h>
 #include <memlayout.h>
 /*
  *完整版SLUB分配器
  *实现真正的对象缓存和重用机制
+ *
+ *两层结构：slub_pmm_manager 是页分配器；对象缓存 (kmalloc) 通过 alloc_pages/free_pages
+ *向当前的 pmm_manager 要页，因此在任何页分配器之上都能使用，由 pmm_init 调用 kmem_init 初始化。
 */
 #define SLUB_MIN_SIZE     16
 #define SLUB_MAX_SIZE     2048
 #define SLUB_CACHE_NUM    8
+#define SLUB_NCPU         4       // 每个 CPU 一个活动 slab，hartid 不小于该值的 CPU 直接用 partial 链表
+#define SLUB_MAX_ORDER    3       // slab 最多占 2^SLUB_MAX_ORDER 页
+#define SLUB_OFF_SLAB     (PGSIZE / 8)  // 不小于该大小的对象，slab_t 放在 slab 之外
+#define SLUB_MIN_FREE     1       // 默认每个缓存收缩后保留的空 slab 数
 
 // Slab结构
 typedef struct slab_s {
@@ -20,29 +28,54 @@ typedef struct slab_s {
     unsigned int inuse;          // 已使用对象数
     unsigned int total;          // 总对象数
     void *cache;                 // 所属缓存指针
-    struct Page *page;           // 对应的物理页
+    struct Page *page;           // 对应的物理页 (2^order 页中的第一页)
+    bool frozen;                 // 是某个 CPU 的活动 slab，此时不在任何链表中
 } slab_t;
 
-// 缓存结构
-typedef struct kmem_cache_s {
+// 缓存结构 (kmem_cache_t 在 kmalloc.h 中声明)
+struct kmem_cache_s {
     const char *name;            // 缓存名称
     size_t obj_size;             // 对象大小
     size_t actual_size;          // 实际大小（对齐后）
+    size_t align;                // 对象对齐
+    size_t offset;               // 第一个对象相对 slab 起始的偏移
+    unsigned int order;          // 每个 slab 占 2^order 页
+    bool off_slab;               // slab_t 不在 slab 页内，而是从 slab_desc_cache 分配
+    size_t free_offset;          // 空闲对象中 next 指针的位置
+    void (*ctor)(void *);        // 构造函数，新 slab 中的每个对象调用一次
     unsigned int objs_per_slab;  // 每个slab的对象数
+    list_entry_t cache_link;     // 挂在 cache_chain 上
     
     // 三种状态的slab链表
     list_entry_t slabs_full;     // 满的slab
     list_entry_t slabs_partial;  // 部分使用的slab
     list_entry_t slabs_free;     // 空闲的slab
+    unsigned int nr_empty;       // slabs_free 上的 slab 数
+    unsigned int min_free;       // 收缩时 slabs_free 上至少保留的 slab 数
+    
+    // 每个 CPU 的活动 slab：分配只从它的 freelist 取对象，不碰链表
+    slab_t *cpu_slab[SLUB_NCPU];
     
     // 统计信息
     unsigned long num_slabs;     // slab数量
     unsigned long num_objects;   // 总对象数
     unsigned long num_free;      // 空闲对象数
-} kmem_cache_t;
+};
 
-// 全局SLUB缓存
+// 全局SLUB缓存：kmalloc 使用的按 2 的幂分级的缓存
 static kmem_cache_t slub_caches[SLUB_CACHE_NUM];
+
+// off-slab 缓存的 slab_t 描述符从这里分配，它自己总是 on-slab
+static kmem_cache_t slab_desc_cache;
+
+// 所有缓存 (包括 kmem_cache_create 创建的) 的链表
+static list_entry_t cache_chain = {&cache_chain, &cache_chain};
+
+#define le2cache(le, member) \
+    to_struct((le), kmem_cache_t, member)
+
+// 对象大小到缓存下标的查找表，按 SLUB_MIN_SIZE 为粒度向上取整
+static uint8_t slub_size_table[SLUB_MAX_SIZE / SLUB_MIN_SIZE + 1];
 static free_area_t free_area;
 
 #define free_list (free_area.free_list)
@@ -54,7 +87,7 @@ static free_area_t free_area;
 
 // 页到内核虚拟地址的转换
 static inline void* page2kva(struct Page *page) {
-    return (void *)((page - pages) * PGSIZE + KERNBASE);
+    return (void *)(page2pa(page) + va_pa_offset);
 }
 
 // 内核虚拟地址到页的转换
@@ -62,6 +95,16 @@ static inline struct Page* kva2page(void *kva) {
     return pa2page(PADDR(kva));
 }
 
+// 空闲对象的 next 指针：没有构造函数时放在对象开头，
+// 有构造函数时放在对象之后，不破坏已构造的内容
+static inline void *get_freeptr(kmem_cache_t *cache, void *obj) {
+    return *(void**)((char*)obj + cache->free_offset);
+}
+
+static inline void set_freeptr(kmem_cache_t *cache, void *obj, void *next) {
+    *(void**)((char*)obj + cache->free_offset) = next;
+}
+
 // 计算链表大小
 static int list_size(list_entry_t *list) {
     int size = 0;
@@ -72,16 +115,20 @@ static int list_size(list_entry_t *list) {
     return size;
 }
 
-// 计算对象大小对应的缓存索引
-static int slub_size_index(size_t size) {
-    int index = 0;
-    size_t current_size = SLUB_MIN_SIZE;
-    
-    while (current_size < size && index < SLUB_CACHE_NUM - 1) {
-        current_size <<= 1;
-        index++;
-    }
-    return index;
+// 计算对象大小对应的缓存索引，查表 O(1)
+static inline int slub_size_index(size_t size) {
+    return slub_size_table[(size + SLUB_MIN_SIZE - 1) / SLUB_MIN_SIZE];
+}
+
+// 当前 CPU 编号，entry.S 把 hartid 保存在 tp 中
+static inline int cpuid(void) {
+#ifdef PMM_HOST
+    return 0;       // 主机侧基准测试只有一个线程
+#else
+    uintptr_t hartid;
+    asm volatile("mv %0, tp" : "=r"(hartid));
+    return hartid;
+#endif
 }
 
 // 从SLUB分配页（底层页分配器）
@@ -111,8 +158,7 @@ slub_alloc_pages(size_t n) {
         
         if (page->property > n) {
             struct Page *p = page + n;
-            p->property = page->property - n;
-            SetPageProperty(p);
+            set_block_tags(p, page->property - n);
             list_add(prev, &(p->page_link));
         }
         
@@ -128,40 +174,105 @@ static void
 slub_init(void) {
     list_init(&free_list);
     nr_free = 0;
+}
+
+// 选择 slab 的阶：浪费不超过 1/16 的最小阶，都做不到时取浪费比例最小的阶
+static unsigned int
+slub_calc_order(size_t offset, size_t size) {
+    unsigned int best = SLUB_MAX_ORDER + 1;
+    size_t best_waste = 0, best_bytes = 1;
+    for (unsigned int order = 0; order <= SLUB_MAX_ORDER; order++) {
+        size_t bytes = PGSIZE << order;
+        if (offset + size > bytes) {
+            continue;
+        }
+        size_t waste = offset + (bytes - offset) % size;
+        if (waste * 16 <= bytes) {
+            return order;
+        }
+        if (best > SLUB_MAX_ORDER || waste * best_bytes < best_waste * bytes) {
+            best = order;
+            best_waste = waste;
+            best_bytes = bytes;
+        }
+    }
+    assert(best <= SLUB_MAX_ORDER);
+    return best;
+}
+
+// 按对象大小、对齐和构造函数计算缓存的布局并初始化
+static void
+kmem_cache_setup(kmem_cache_t *cache, const char *name, size_t size,
+                 size_t align, void (*ctor)(void *)) {
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    assert((align & (align - 1)) == 0);
+    
+    cache->name = name;
+    cache->obj_size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+    if (ctor != NULL) {
+        cache->free_offset = ROUNDUP(size, sizeof(void*));
+        cache->actual_size = ROUNDUP(cache->free_offset + sizeof(void*), align);
+    } else {
+        cache->free_offset = 0;
+        cache->actual_size = ROUNDUP(size < sizeof(void*) ? sizeof(void*) : size, align);
+    }
+    
+    // 大对象的 slab_t 放在 slab 之外，对象可以从 slab 起始处排起
+    cache->off_slab = (cache->actual_size >= SLUB_OFF_SLAB && cache != &slab_desc_cache);
+    cache->offset = cache->off_slab ? 0 : ROUNDUP(sizeof(slab_t), align);
+    
+    // 计算每个slab能存放的对象数
+    cache->order = slub_calc_order(cache->offset, cache->actual_size);
+    cache->objs_per_slab = ((PGSIZE << cache->order) - cache->offset) / cache->actual_size;
+    
+    // 初始化链表
+    list_init(&cache->slabs_full);
+    list_init(&cache->slabs_partial);
+    list_init(&cache->slabs_free);
+    cache->nr_empty = 0;
+    cache->min_free = SLUB_MIN_FREE;
+    for (int cpu = 0; cpu < SLUB_NCPU; cpu++) {
+        cache->cpu_slab[cpu] = NULL;
+    }
+    
+    // 初始化统计信息
+    cache->num_slabs = 0;
+    cache->num_objects = 0;
+    cache->num_free = 0;
     
+    list_add_before(&cache_chain, &cache->cache_link);
+}
+
+// 初始化对象缓存，在 page_init 之后、第一次 kmalloc 之前调用
+void
+kmem_init(void) {
     // 初始化各种大小的缓存
-    size_t sizes[SLUB_CACHE_NUM] = {16, 32, 64, 128, 256, 512, 1024, 2048};
-    const char *names[SLUB_CACHE_NUM] = {
+    static size_t sizes[SLUB_CACHE_NUM] = {16, 32, 64, 128, 256, 512, 1024, 2048};
+    static const char *names[SLUB_CACHE_NUM] = {
         "slub-16", "slub-32", "slub-64", "slub-128",
         "slub-256", "slub-512", "slub-1024", "slub-2048"
     };
     
+    kmem_cache_setup(&slab_desc_cache, "slab_t", sizeof(slab_t), 0, NULL);
     for (int i = 0; i < SLUB_CACHE_NUM; i++) {
-        slub_caches[i].name = names[i];
-        slub_caches[i].obj_size = sizes[i];
-        slub_caches[i].actual_size = sizes[i];
-        
-        // 计算每个slab能存放的对象数
-        size_t slab_usable = PGSIZE - sizeof(slab_t);
-        slub_caches[i].objs_per_slab = slab_usable / slub_caches[i].actual_size;
-        if (slub_caches[i].objs_per_slab == 0) {
-            slub_caches[i].objs_per_slab = 1;
-        }
-        
-        // 初始化链表
-        list_init(&slub_caches[i].slabs_full);
-        list_init(&slub_caches[i].slabs_partial);
-        list_init(&slub_caches[i].slabs_free);
-        
-        // 初始化统计信息
-        slub_caches[i].num_slabs = 0;
-        slub_caches[i].num_objects = 0;
-        slub_caches[i].num_free = 0;
-        
+        kmem_cache_setup(&slub_caches[i], names[i], sizes[i], 0, NULL);
         cprintf("slub: 缓存 %s - 对象大小=%d字节, 每slab对象数=%d\n", 
                 names[i], sizes[i], slub_caches[i].objs_per_slab);
     }
     
+    // 填充大小查找表：每个粒度对应能容纳它的最小缓存
+    int index = 0;
+    for (int i = 0; i <= SLUB_MAX_SIZE / SLUB_MIN_SIZE; i++) {
+        while ((size_t)i * SLUB_MIN_SIZE > sizes[index]) {
+            index++;
+        }
+        slub_size_table[i] = index;
+    }
+    
     cprintf("slub: 已初始化 %d 个对象缓存\n", SLUB_CACHE_NUM);
 }
 
@@ -175,8 +286,7 @@ slub_init_memmap(struct Page *base, size_t n) {
         p->flags = p->property = 0;
         set_page_ref(p, 0);
     }
-    base->property = n;
-    SetPageProperty(base);
+    set_block_tags(base, n);
     nr_free += n;
     
     // 添加到空闲链表
@@ -198,33 +308,51 @@ slub_init_memmap(struct Page *base, size_t n) {
 
 // 为缓存分配新的slab - 完整版本
 static slab_t* slub_alloc_slab(kmem_cache_t *cache) {
-    // 分配一页内存
-    struct Page *page = slub_alloc_pages(1);
+    // 分配 2^order 页内存
+    size_t npages = 1UL << cache->order;
+    struct Page *page = alloc_pages(npages);
     if (!page) {
         return NULL;
     }
     
     // 初始化slab结构
-    slab_t *slab = (slab_t*)page2kva(page);
+    slab_t *slab;
+    if (cache->off_slab) {
+        if ((slab = kmem_cache_alloc(&slab_desc_cache)) == NULL) {
+            free_pages(page, npages);
+            return NULL;
+        }
+    } else {
+        slab = (slab_t*)page2kva(page);
+    }
     slab->cache = (void*)cache;
     slab->total = cache->objs_per_slab;
     slab->inuse = 0;
     slab->page = page;
+    slab->frozen = 0;
+    
+    // slab 的每一页都指回描述符，释放对象时由对象地址所在的页找到 slab
+    for (size_t i = 0; i < npages; i++) {
+        SetPageSlab(page + i);
+        page[i].slab = slab;
+    }
     
     // 计算对象起始地址
-    void *objects = (void*)slab + sizeof(slab_t);
+    void *objects = (char*)page2kva(page) + cache->offset;
     
     // 构建空闲对象链表
     slab->freelist = objects;
     void *current = objects;
     
-    // 构建完整的空闲对象链表
-    for (unsigned int i = 0; i < slab->total - 1; i++) {
-        void *next = (char*)current + cache->actual_size;
-        *(void**)current = next;
+    // 构建完整的空闲对象链表，有构造函数时顺便构造每个对象
+    for (unsigned int i = 0; i < slab->total; i++) {
+        void *next = (i + 1 < slab->total) ? (char*)current + cache->actual_size : NULL;
+        if (cache->ctor != NULL) {
+            cache->ctor(current);
+        }
+        set_freeptr(cache, current, next);
         current = next;
     }
-    *(void**)current = NULL;  // 链表结束
     
     // 更新缓存统计
     cache->num_slabs++;
@@ -250,144 +378,307 @@ slub_free_pages(struct Page *base, size_t n) {
         set_page_ref(p, 0);
     }
     
-    base->property = n;
-    SetPageProperty(base);
     nr_free += n;
     
-    // 按地址顺序插入空闲链表
-    if (list_empty(&free_list)) {
-        list_add(&free_list, &(base->page_link));
-    } else {
-        list_entry_t* le = &free_list;
-        while ((le = list_next(le)) != &free_list) {
-            struct Page* page = le2page(le, page_link);
-            if (base < page) {
-                list_add_before(le, &(base->page_link));
-                break;
-            } else if (list_next(le) == &free_list) {
-                list_add(le, &(base->page_link));
-            }
-        }
+    // 通过边界标记找到物理相邻的空闲块；合并后的块沿用被合并邻居在链表中的位置，
+    // 链表仍按地址有序，无需遍历
+    struct Page *prev = prev_free_block(base);
+    struct Page *next = next_free_block(base, n);
+    if (prev != NULL) {
+        n += prev->property;
+        base = prev;
+    } else if (next != NULL) {
+        list_add_before(&(next->page_link), &(base->page_link));
     }
-    
-    // 尝试合并相邻的空闲块
-    list_entry_t* le = list_prev(&(base->page_link));
-    if (le != &free_list) {
-        p = le2page(le, page_link);
-        if (p + p->property == base) {
-            p->property += base->property;
-            ClearPageProperty(base);
-            list_del(&(base->page_link));
-            base = p;
-        }
+    if (next != NULL) {
+        n += next->property;
+        ClearPageProperty(next);
+        list_del(&(next->page_link));
+    }
+    set_block_tags(base, n);
+    if (prev != NULL || next != NULL) {
+        return;
     }
     
-    le = list_next(&(base->page_link));
-    if (le != &free_list) {
-        p = le2page(le, page_link);
-        if (base + base->property == p) {
-            base->property += p->property;
-            ClearPageProperty(p);
-            list_del(&(p->page_link));
+    // 没有空闲邻居：first-fit 依赖地址顺序，只能查找插入位置
+    list_entry_t* le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        if (base < le2page(le, page_link)) {
+            break;
         }
     }
+    list_add_before(le, &(base->page_link));
 }
 
-// 获取空闲页数
 static size_t
 slub_nr_free_pages(void) {
     return nr_free;
 }
 
-// 从缓存分配对象 - 完整版本
-void* slub_alloc_obj(size_t size) {
-    if (size > SLUB_MAX_SIZE) {
-        // 大对象直接分配页
-        size_t pages_needed = (size + PGSIZE - 1) / PGSIZE;
-        struct Page *page = slub_alloc_pages(pages_needed);
-        return page ? page2kva(page) : NULL;
+// 统计空闲页块
+static void
+slub_stats(struct pmm_stats *st) {
+    list_entry_t *le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        pmm_stats_add_blocks(st, le2page(le, page_link)->property, 1);
     }
-    
-    int index = slub_size_index(size);
-    kmem_cache_t *cache = &slub_caches[index];
-    
-    slab_t *slab = NULL;
-    list_entry_t *le = NULL;
-    
-    // 查找策略：partial -> free -> new slab
-    if (!list_empty(&cache->slabs_partial)) {
-        le = list_next(&cache->slabs_partial);
-        slab = le2slab(le, slab_link);
-    } 
-    else if (!list_empty(&cache->slabs_free)) {
-        le = list_next(&cache->slabs_free);
-        slab = le2slab(le, slab_link);
-        // 从free链表移动到partial链表
-        list_del(&slab->slab_link);
-        list_add(&slab->slab_link, &cache->slabs_partial);
+}
+
+// 释放一个空 slab 的页
+static void slub_free_slab(kmem_cache_t *cache, slab_t *slab) {
+    assert(slab->inuse == 0);
+    cache->num_slabs--;
+    cache->num_objects -= slab->total;
+    cache->num_free -= slab->total;
+    size_t npages = 1UL << cache->order;
+    struct Page *page = slab->page;
+    for (size_t i = 0; i < npages; i++) {
+        ClearPageSlab(page + i);
     }
-    else {
-        // 分配新的slab
-        slab = slub_alloc_slab(cache);
-        if (slab) {
-            list_add(&slab->slab_link, &cache->slabs_partial);
-        }
+    if (cache->off_slab) {
+        kmem_cache_free(&slab_desc_cache, slab);
+    }
+    free_pages(page, npages);
+}
+
+// 活动 slab 用完后的慢速路径：满的 slab 挂到 full 链表，
+// 再按 partial -> free -> new slab 的顺序取一个新的活动 slab
+static void* slub_alloc_slow(kmem_cache_t *cache, slab_t **active) {
+    slab_t *slab = *active;
+    if (slab != NULL) {
+        slab->frozen = 0;
+        list_add(&cache->slabs_full, &slab->slab_link);
+        *active = NULL;
     }
     
-    if (!slab || !slab->freelist) {
+    if (!list_empty(&cache->slabs_partial)) {
+        slab = le2slab(list_next(&cache->slabs_partial), slab_link);
+        list_del(&slab->slab_link);
+    } else if (!list_empty(&cache->slabs_free)) {
+        slab = le2slab(list_next(&cache->slabs_free), slab_link);
+        list_del(&slab->slab_link);
+        cache->nr_empty--;
+    } else if ((slab = slub_alloc_slab(cache)) == NULL) {
         return NULL;
     }
+    slab->frozen = 1;
+    *active = slab;
     
-    // 分配对象
     void *obj = slab->freelist;
-    slab->freelist = *(void**)obj;
+    slab->freelist = get_freeptr(cache, obj);
     slab->inuse++;
     cache->num_free--;
-    
-    // 更新slab状态
-    list_del(&slab->slab_link);
-    
-    if (slab->inuse == slab->total) {
-        // slab已满，移动到full链表
-        list_add(&slab->slab_link, &cache->slabs_full);
-    } else {
-        // 还有空闲对象，放回partial链表
-        list_add(&slab->slab_link, &cache->slabs_partial);
+    return obj;
+}
+
+// 没有 cpu_slab 槽位的 CPU 的分配路径：不冻结 slab，按 partial -> free -> new slab
+// 的顺序取 slab 分配，再按分配后的状态把它挂到 partial 或 full 链表
+static void* slub_alloc_shared(kmem_cache_t *cache) {
+    slab_t *slab;
+    if (!list_empty(&cache->slabs_partial)) {
+        slab = le2slab(list_next(&cache->slabs_partial), slab_link);
+        list_del(&slab->slab_link);
+    } else if (!list_empty(&cache->slabs_free)) {
+        slab = le2slab(list_next(&cache->slabs_free), slab_link);
+        list_del(&slab->slab_link);
+        cache->nr_empty--;
+    } else if ((slab = slub_alloc_slab(cache)) == NULL) {
+        return NULL;
     }
     
+    void *obj = slab->freelist;
+    slab->freelist = get_freeptr(cache, obj);
+    slab->inuse++;
+    cache->num_free--;
+    list_add(slab->inuse == slab->total ? &cache->slabs_full : &cache->slabs_partial,
+             &slab->slab_link);
     return obj;
 }
 
-// 释放对象到缓存 - 完整版本
-void slub_free_obj(void *obj) {
-    if (!obj) return;
-    
-    // 找到对象所属的slab
-    struct Page *page = kva2page(obj);
-    slab_t *slab = (slab_t*)page2kva(page);
-    kmem_cache_t *cache = (kmem_cache_t*)slab->cache;
-    
+// kmem_cache_alloc - 从 cache 分配一个对象
+void* kmem_cache_alloc(kmem_cache_t *cache) {
+    int cpu = cpuid();
+    if (cpu >= SLUB_NCPU) {
+        return slub_alloc_shared(cache);
+    }
+    slab_t **active = &cache->cpu_slab[cpu];
+    
+    // 快速路径：直接从活动 slab 的 freelist 弹出一个对象，不做任何链表操作
+    slab_t *slab = *active;
+    void *obj;
+    if (slab != NULL && (obj = slab->freelist) != NULL) {
+        slab->freelist = get_freeptr(cache, obj);
+        slab->inuse++;
+        cache->num_free--;
+        return obj;
+    }
+    return slub_alloc_slow(cache, active);
+}
+
+// 把对象还给它所在的 slab
+static void slub_slab_free(kmem_cache_t *cache, slab_t *slab, void *obj) {
     // 将对象放回空闲链表
-    *(void**)obj = slab->freelist;
+    set_freeptr(cache, obj, slab->freelist);
     slab->freelist = obj;
     slab->inuse--;
     cache->num_free++;
     
-    // 更新slab在链表中的位置
-    list_del(&slab->slab_link);
-    
+    // 活动 slab 不在任何链表中；其余 slab 只在状态变化时换链表
+    if (slab->frozen) {
+        return;
+    }
     if (slab->inuse == 0) {
         // slab完全空闲，移动到free链表
-        list_add(&slab->slab_link, &cache->slabs_free);
-    } else {
-        // slab部分使用，移动到partial链表
-        list_add(&slab->slab_link, &cache->slabs_partial);
+        list_del(&slab->slab_link);
+        list_add(&cache->slabs_free, &slab->slab_link);
+        cache->nr_empty++;
+    } else if (slab->inuse == slab->total - 1) {
+        // 原先是满的，移动到partial链表
+        list_del(&slab->slab_link);
+        list_add(&cache->slabs_partial, &slab->slab_link);
     }
 }
 
+// kmem_cache_free - 释放 kmem_cache_alloc 得到的对象
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    struct Page *page = kva2page(obj);
+    assert(PageSlab(page));
+    slab_t *slab = page->slab;
+    assert(slab->cache == cache);
+    slub_slab_free(cache, slab, obj);
+}
+
+// kmem_cache_create - 创建对象大小为 size、按 align 对齐的缓存。
+// ctor 不为 NULL 时，对象在 slab 创建时构造，释放前应恢复到构造后的状态
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *)) {
+    assert(size > 0);
+    kmem_cache_t *cache = kmalloc(sizeof(kmem_cache_t), 0);
+    if (cache != NULL) {
+        kmem_cache_setup(cache, name, size, align, ctor);
+    }
+    return cache;
+}
+
+// kmem_cache_shrink - 把多于 min_free 个的空 slab 还给页分配器，返回释放的页数。
+// 新变空的 slab 插在 slabs_free 头部，从尾部回收最久未用的
+size_t kmem_cache_shrink(kmem_cache_t *cache) {
+    size_t freed = 0;
+    while (cache->nr_empty > cache->min_free) {
+        slab_t *slab = le2slab(list_prev(&cache->slabs_free), slab_link);
+        list_del(&slab->slab_link);
+        cache->nr_empty--;
+        slub_free_slab(cache, slab);
+        freed += 1UL << cache->order;
+    }
+    return freed;
+}
+
+// kmem_shrink_all - 收缩所有缓存，页分配器内存紧张时调用
+size_t kmem_shrink_all(void) {
+    size_t freed = 0;
+    list_entry_t *le = &cache_chain;
+    while ((le = list_next(le)) != &cache_chain) {
+        freed += kmem_cache_shrink(le2cache(le, cache_link));
+    }
+    return freed;
+}
+
+// kmem_nr_cached_pages - 所有缓存的空 slab 占用的页数
+size_t kmem_nr_cached_pages(void) {
+    size_t pages = 0;
+    list_entry_t *le = &cache_chain;
+    while ((le = list_next(le)) != &cache_chain) {
+        kmem_cache_t *cache = le2cache(le, cache_link);
+        pages += (size_t)cache->nr_empty << cache->order;
+    }
+    return pages;
+}
+
+// kmem_cache_destroy - 销毁缓存，其中的对象必须已经全部释放
+void kmem_cache_destroy(kmem_cache_t *cache) {
+    assert(cache->num_free == cache->num_objects);
+    assert(list_empty(&cache->slabs_full) && list_empty(&cache->slabs_partial));
+    for (int cpu = 0; cpu < SLUB_NCPU; cpu++) {
+        if (cache->cpu_slab[cpu] != NULL) {
+            slub_free_slab(cache, cache->cpu_slab[cpu]);
+            cache->cpu_slab[cpu] = NULL;
+        }
+    }
+    while (!list_empty(&cache->slabs_free)) {
+        slab_t *slab = le2slab(list_next(&cache->slabs_free), slab_link);
+        list_del(&slab->slab_link);
+        slub_free_slab(cache, slab);
+    }
+    list_del(&cache->cache_link);
+    kfree(cache);
+}
+
+// 从缓存分配对象 - 完整版本
+void* slub_alloc_obj(size_t size) {
+    if (size > SLUB_MAX_SIZE) {
+        // 大对象直接分配页，页数记在首页的 property 中供释放和 ksize 使用
+        size_t pages_needed = (size + PGSIZE - 1) / PGSIZE;
+        struct Page *page = alloc_pages(pages_needed);
+        if (page == NULL) {
+            return NULL;
+        }
+        page->property = pages_needed;
+        return page2kva(page);
+    }
+    return kmem_cache_alloc(&slub_caches[slub_size_index(size)]);
+}
+
+// 释放对象到缓存 - 完整版本
+void slub_free_obj(void *obj) {
+    if (!obj) return;
+    
+    // 找到对象所属的slab
+    struct Page *page = kva2page(obj);
+    if (!PageSlab(page)) {
+        // 直接分配页的大对象
+        free_pages(page, page->property);
+        return;
+    }
+    slab_t *slab = page->slab;
+    slub_slab_free((kmem_cache_t*)slab->cache, slab, obj);
+}
+
+// 对象实际可用的字节数：slab 对象为所属缓存的对象大小，大对象为整页
+static size_t slub_obj_size(void *obj) {
+    struct Page *page = kva2page(obj);
+    if (!PageSlab(page)) {
+        return page->property * PGSIZE;
+    }
+    slab_t *slab = page->slab;
+    return ((kmem_cache_t*)slab->cache)->obj_size;
+}
+
+// kmalloc - 分配 size 字节的内核内存，失败返回 NULL
+void *kmalloc(size_t size, unsigned int flags) {
+    if (size == 0) {
+        return NULL;
+    }
+    void *obj = slub_alloc_obj(size);
+    if (obj != NULL && (flags & KM_ZERO)) {
+        memset(obj, 0, size);
+    }
+    return obj;
+}
+
+// kfree - 释放 kmalloc 返回的内存，ptr 为 NULL 时什么也不做
+void kfree(void *ptr) {
+    slub_free_obj(ptr);
+}
+
+// ksize - ptr 指向的内存实际可用的字节数，不小于分配时请求的大小
+size_t ksize(void *ptr) {
+    return ptr != NULL ? slub_obj_size(ptr) : 0;
+}
+
 // 显示缓存统计信息
 static void slub_show_cache_stats(kmem_cache_t *cache) {
-    int full_count = 0, partial_count = 0, free_count = 0;
+    int full_count = 0, partial_count = 0, free_count = 0, active_count = 0;
     
     list_entry_t *le;
     le = &cache->slabs_full;
@@ -399,8 +690,12 @@ static void slub_show_cache_stats(kmem_cache_t *cache) {
     le = &cache->slabs_free;
     while ((le = list_next(le)) != &cache->slabs_free) free_count++;
     
-    cprintf("  %s: slabs=%d/%d/%d, 对象=%d/%d (已用/空闲)\n",
-            cache->name, full_count, partial_count, free_count,
+    for (int cpu = 0; cpu < SLUB_NCPU; cpu++) {
+        if (cache->cpu_slab[cpu] != NULL) active_count++;
+    }
+    
+    cprintf("  %s: slabs=%d/%d/%d/%d (满/部分/空/活动), 对象=%d/%d (已用/空闲)\n",
+            cache->name, full_count, partial_count, free_count, active_count,
             cache->num_objects - cache->num_free, cache->num_free);
 }
 
@@ -482,6 +777,44 @@ slub_check(void) {
         cprintf("   大对象分配测试失败\n");
     }
     
+    cprintf("\n--- 测试 5: 活动 slab 快速路径测试 ---\n");
+    // 没有 cpu_slab 槽位的 CPU 不走活动 slab，跳过
+    if (cpuid() < SLUB_NCPU) {
+        kmem_cache_t *cache = &slub_caches[slub_size_index(256)];
+        assert(cache == &slub_caches[4] && slub_size_index(255) == 4 && slub_size_index(257) == 5);
+        unsigned int per = cache->objs_per_slab;
+        int full = list_size(&cache->slabs_full);
+        int partial = list_size(&cache->slabs_partial);
+        int empty = list_size(&cache->slabs_free);
+        
+        // 取出活动 slab 剩余的对象，全部走快速路径，链表不变
+        void *first = slub_alloc_obj(256);
+        slab_t *active = cache->cpu_slab[cpuid()];
+        assert(first != NULL && active != NULL && active->frozen);
+        void *objs5[64];
+        unsigned int n = 0;
+        while (active->freelist != NULL) {
+            objs5[n++] = slub_alloc_obj(256);
+        }
+        assert(active->inuse == per);
+        assert(list_size(&cache->slabs_full) == full && list_size(&cache->slabs_partial) == partial);
+        
+        // 下一次分配换活动 slab，用完的那个此时才挂到 full 链表
+        void *next = slub_alloc_obj(256);
+        assert(next != NULL && cache->cpu_slab[cpuid()] != active && !active->frozen);
+        assert(list_size(&cache->slabs_full) == full + 1);
+        
+        // full -> partial -> free，只在状态变化时换链表
+        slub_free_obj(first);
+        assert(list_size(&cache->slabs_full) == full && list_size(&cache->slabs_partial) == partial + 1);
+        for (unsigned int i = 0; i < n; i++) {
+            slub_free_obj(objs5[i]);
+        }
+        assert(active->inuse == 0 && list_size(&cache->slabs_free) == empty + 1);
+        slub_free_obj(next);
+        cprintf("   活动 slab 与链表迁移检查通过\n");
+    }
+    
     cprintf("\n--- 最终缓存统计信息 ---\n");
     for (int i = 0; i < SLUB_CACHE_NUM; i++) {
         slub_show_cache_stats(&slub_caches[i]);
@@ -500,6 +833,7 @@ const struct pmm_manager slub_pmm_manager = {
     .free_pages = slub_free_pages,
     .nr_free_pages = slub_nr_free_pages,
     .check = slub_check,
+    .stats = slub_stats,
 };
 
 
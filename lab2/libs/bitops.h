@@ -0,0 +1,30 @@
+#ifndef __LIBS_BITOPS_H__
+#define __LIBS_BITOPS_H__
+
+#include <defs.h>
+
+/* *
+ * Bit scanning without __builtin_ctz/__builtin_clz: on RISC-V cores without
+ * the Zbb extension gcc lowers those to __ctzdi2/__clzdi2 calls into libgcc,
+ * which the kernel does not link against.
+ * */
+
+static const uint8_t __debruijn_ctz64[64] = {
+     0,  1,  2, 53,  3,  7, 54, 27,  4, 38, 41,  8, 34, 55, 48, 28,
+    62,  5, 39, 46, 44, 42, 22,  9, 24, 35, 59, 56, 49, 18, 29, 11,
+    63, 52,  6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+    51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12,
+};
+
+/* *
+ * ctz64 - index of the lowest set bit of @x, 64 if @x is zero
+ * */
+static inline int
+ctz64(uint64_t x) {
+    if (x == 0) {
+        return 64;
+    }
+    return __debruijn_ctz64[((x & -x) * 0x022FDD63CC95386DULL) >> 58];
+}
+
+#endif /* !__LIBS_BITOPS_H__ */
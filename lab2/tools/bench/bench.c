@@ -0,0 +1,366 @@
+/* *
+ * pmm_bench - host-side benchmark for the lab2 pmm managers.
+ *
+ * Every manager is compiled natively and linked against shim.c, which gives
+ * it a heap-backed pages[] array. Each (manager, workload) pair runs in its
+ * own child process, so one manager's static state or a failed assertion
+ * cannot leak into the next run. For every run it reports throughput,
+ * alloc/free latency percentiles, allocations that failed although enough
+ * pages were free, and the fragmentation left at the end of the run.
+ *
+ * Workloads:
+ *   mixed   random alloc/free of 1..256 pages, skewed towards small blocks,
+ *           holding up to 3/4 of memory
+ *   single  the same churn with single pages only
+ *   trace   replay of a recorded trace (-t file), one operation per line:
+ *             a <key> <n>    allocate n pages and remember them as <key>
+ *             f <key> [n]    free the block remembered as <key>
+ *           numbers are hex and anything after them is ignored, so the
+ *           output of pmm_trace_dump (kernel built with -DPMM_TRACE, keys
+ *           being PFNs) replays as is; blank lines and lines starting with
+ *           '#' are skipped
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define PAGE_BYTES      4096
+
+static int verbose = 0;
+
+/* what kern/libs/stdio.c and kern/debug/panic.c provide in the kernel */
+int cprintf(const char *fmt, ...) {
+    if (!verbose) {
+        return 0;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int cnt = vprintf(fmt, ap);
+    va_end(ap);
+    return cnt;
+}
+
+void __panic(const char *file, int line, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fflush(stdout);
+    fprintf(stderr, "kernel panic at %s:%d:\n    ", file, line);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    abort();
+}
+
+void __warn(const char *file, int line, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "kernel warning at %s:%d:\n    ", file, line);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+}
+
+static unsigned long npages = 32768;    // 128 MiB of simulated memory
+static unsigned long nops = 200000;
+static unsigned long long seed = 1;
+static int run_check = 0;
+static const char *trace_file = NULL;
+
+/* one operation of a workload; key names the block for trace replay */
+struct op {
+    char alloc;
+    unsigned long key;
+    unsigned long n;
+};
+
+/* a live allocation */
+struct block {
+    long idx;
+    unsigned long n;
+    unsigned long key;
+};
+
+static struct block *live;
+static unsigned long nlive, live_pages;
+static unsigned long nalloc_fail;       // failed although nr_free >= n
+
+static unsigned long long *alloc_ns, *free_ns;
+static unsigned long nalloc_ns, nfree_ns;
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long rand64(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+// rand_size - 1 page 70%, 2-8 20%, 9-64 8%, 65-256 2%
+static unsigned long rand_size(void) {
+    unsigned long r = rand64() % 100;
+    if (r < 70) {
+        return 1;
+    } else if (r < 90) {
+        return 2 + rand64() % 7;
+    } else if (r < 98) {
+        return 9 + rand64() % 56;
+    }
+    return 65 + rand64() % 192;
+}
+
+static void do_alloc(unsigned long n, unsigned long key) {
+    unsigned long nr_free = bench_nr_free();
+    unsigned long long t = now_ns();
+    long idx = bench_alloc(n);
+    alloc_ns[nalloc_ns ++] = now_ns() - t;
+    if (idx < 0) {
+        if (nr_free >= n) {
+            nalloc_fail ++;
+        }
+        return;
+    }
+    live[nlive ++] = (struct block){idx, n, key};
+    live_pages += n;
+}
+
+static void do_free(unsigned long i) {
+    struct block b = live[i];
+    live[i] = live[-- nlive];
+    live_pages -= b.n;
+    unsigned long long t = now_ns();
+    bench_free(b.idx, b.n);
+    free_ns[nfree_ns ++] = now_ns() - t;
+}
+
+// run_synthetic - nops random operations, allocating while under 3/4 full
+static void run_synthetic(int single) {
+    for (unsigned long i = 0; i < nops; i ++) {
+        if (nlive == 0 || (live_pages < npages / 4 * 3 && rand64() % 100 < 55)) {
+            do_alloc(single ? 1 : rand_size(), 0);
+        } else {
+            do_free(rand64() % nlive);
+        }
+    }
+}
+
+static int parse_trace(struct op **ops, unsigned long *n) {
+    FILE *fp = fopen(trace_file, "r");
+    if (fp == NULL) {
+        perror(trace_file);
+        return -1;
+    }
+    unsigned long cap = 1024;
+    char line[128], kind;
+    *ops = malloc(cap * sizeof(struct op));
+    *n = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        struct op o = {0, 0, 0};
+        int fields = sscanf(line, " %c %lx %lx", &kind, &o.key, &o.n);
+        if (fields <= 0 || kind == '#') {
+            continue;
+        }
+        if ((kind != 'a' && kind != 'f') || fields < 2 || (kind == 'a' && fields < 3)) {
+            fprintf(stderr, "%s: bad line: %s", trace_file, line);
+            fclose(fp);
+            return -1;
+        }
+        o.alloc = (kind == 'a');
+        if (*n == cap) {
+            *ops = realloc(*ops, (cap *= 2) * sizeof(struct op));
+        }
+        (*ops)[(*n) ++] = o;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// run_trace - replay a recorded trace; frees of blocks whose allocation
+// failed under this manager are skipped
+static void run_trace(struct op *ops, unsigned long n) {
+    for (unsigned long i = 0; i < n; i ++) {
+        if (ops[i].alloc) {
+            do_alloc(ops[i].n, ops[i].key);
+            continue;
+        }
+        // the newest live block with the key: a PFN can be reused once freed
+        unsigned long j = nlive;
+        while (j > 0 && live[j - 1].key != ops[i].key) {
+            j --;
+        }
+        if (j > 0) {
+            do_free(j - 1);
+        }
+    }
+}
+
+static int cmp_ns(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_latency(unsigned long long *ns, unsigned long n) {
+    if (n == 0) {
+        printf("  %7s %7s %7s %8s", "-", "-", "-", "-");
+        return;
+    }
+    qsort(ns, n, sizeof(ns[0]), cmp_ns);
+    printf("  %7llu %7llu %7llu %8llu", ns[n / 2], ns[n * 9 / 10],
+           ns[n * 99 / 100], ns[n - 1]);
+}
+
+// print_fragmentation - free pages, the largest block the manager can still
+// hand out (found by probing with alloc/free) and the share of free memory
+// outside it: 0 when all free memory is one allocatable block
+static void print_fragmentation(void) {
+    unsigned long nfree = bench_nr_free(), lo = 0, hi = nfree;
+    while (lo < hi) {
+        unsigned long mid = lo + (hi - lo + 1) / 2;
+        long idx = bench_alloc(mid);
+        if (idx >= 0) {
+            bench_free(idx, mid);
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    printf("  %6lu %7lu %5.3f", nfree, lo, nfree ? 1.0 - (double)lo / nfree : 0.0);
+}
+
+static void bench_one(int mgr, const char *workload, struct op *ops, unsigned long n) {
+    void *page_array = calloc(npages, bench_page_struct_size());
+    void *mem = calloc(npages, PAGE_BYTES);
+    unsigned long max_ops = ops != NULL ? n : nops;
+    if (page_array == NULL || mem == NULL) {
+        fprintf(stderr, "out of host memory\n");
+        exit(1);
+    }
+    live = malloc(max_ops * sizeof(struct block));
+    alloc_ns = malloc(max_ops * sizeof(unsigned long long));
+    free_ns = malloc(max_ops * sizeof(unsigned long long));
+
+    bench_setup(mgr, page_array, mem, npages);
+    if (run_check) {
+        bench_check();
+    }
+    unsigned long long start = now_ns();
+    if (ops != NULL) {
+        run_trace(ops, n);
+    } else {
+        run_synthetic(strcmp(workload, "single") == 0);
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    printf("%-12s %-7s %10.0f", bench_manager_name(mgr), workload,
+           (nalloc_ns + nfree_ns) / secs);
+    print_latency(alloc_ns, nalloc_ns);
+    print_latency(free_ns, nfree_ns);
+    printf("  %5lu", nalloc_fail);
+    print_fragmentation();
+    printf("\n");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-m manager]... [-w mixed|single]... [-t trace]\n"
+            "       [-n pages] [-o ops] [-s seed] [-c] [-v]\n"
+            "  -c  run each manager's check() hook first\n"
+            "  -v  show what the managers print\n"
+            "managers:", prog);
+    for (int i = 0; i < bench_nr_managers(); i ++) {
+        fprintf(stderr, " %s", bench_manager_name(i));
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int nmgrs = bench_nr_managers(), nwl = 0, opt;
+    char *pick = calloc(nmgrs, 1), any = 0;
+    const char *workloads[3];
+    while ((opt = getopt(argc, argv, "m:w:t:n:o:s:cv")) != -1) {
+        switch (opt) {
+        case 'm': {
+            int i = 0;
+            while (i < nmgrs && strcmp(optarg, bench_manager_name(i)) != 0) {
+                i ++;
+            }
+            if (i == nmgrs) {
+                usage(argv[0]);
+            }
+            pick[i] = any = 1;
+            break;
+        }
+        case 'w':
+            if ((strcmp(optarg, "mixed") != 0 && strcmp(optarg, "single") != 0) || nwl == 2) {
+                usage(argv[0]);
+            }
+            workloads[nwl ++] = optarg;
+            break;
+        case 't': trace_file = optarg; break;
+        case 'n': npages = strtoul(optarg, NULL, 0); break;
+        case 'o': nops = strtoul(optarg, NULL, 0); break;
+        case 's': seed = strtoull(optarg, NULL, 0) | 1; break;
+        case 'c': run_check = 1; break;
+        case 'v': verbose = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || npages == 0) {
+        usage(argv[0]);
+    }
+    if (nwl == 0 && trace_file == NULL) {
+        workloads[nwl ++] = "mixed";
+        workloads[nwl ++] = "single";
+    }
+    struct op *ops = NULL;
+    unsigned long n = 0;
+    // keep a run's output ahead of whatever it prints when it dies
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (trace_file != NULL) {
+        if (parse_trace(&ops, &n) != 0) {
+            return 1;
+        }
+        workloads[nwl ++] = "trace";
+    }
+
+    printf("%lu pages, %lu ops, seed %llu; latency in ns, frag = 1 - largest/free\n",
+           npages, nops, seed);
+    printf("%-12s %-7s %10s  %7s %7s %7s %8s  %7s %7s %7s %8s  %5s  %6s %7s %5s\n",
+           "manager", "load", "ops/s", "a.p50", "a.p90", "a.p99", "a.max",
+           "f.p50", "f.p90", "f.p99", "f.max", "fails", "free", "largest", "frag");
+    int status = 0;
+    for (int m = 0; m < nmgrs; m ++) {
+        if (any && !pick[m]) {
+            continue;
+        }
+        for (int w = 0; w < nwl; w ++) {
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                int is_trace = strcmp(workloads[w], "trace") == 0;
+                bench_one(m, workloads[w], is_trace ? ops : NULL, n);
+                fflush(stdout);
+                _exit(0);
+            }
+            int wstatus;
+            if (pid < 0 || waitpid(pid, &wstatus, 0) < 0 || !WIFEXITED(wstatus)
+                || WEXITSTATUS(wstatus) != 0) {
+                printf("%-12s %-7s failed\n", bench_manager_name(m), workloads[w]);
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
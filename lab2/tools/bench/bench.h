@@ -0,0 +1,31 @@
+#ifndef __TOOLS_BENCH_BENCH_H__
+#define __TOOLS_BENCH_BENCH_H__
+
+/* *
+ * Interface between the host-side benchmark driver (bench.c, built against
+ * the host libc) and the shim (shim.c, built with the kernel headers and
+ * linked with the pmm managers). Only plain C types cross it, so neither
+ * side needs the other's headers. Pages are named by their index in the
+ * shim's pages[] array.
+ * */
+
+// number of managers built into the benchmark, and the name of each
+int bench_nr_managers(void);
+const char *bench_manager_name(int mgr);
+
+// sizeof(struct Page), so the driver can size the array it hands to the shim
+unsigned long bench_page_struct_size(void);
+
+// make manager mgr the pmm_manager over npages frames: page_array holds
+// npages struct Pages, mem is npages * 4096 bytes of backing memory
+void bench_setup(int mgr, void *page_array, void *mem, unsigned long npages);
+
+// run the manager's own check() hook
+void bench_check(void);
+
+// allocate n contiguous pages, returning the index of the first or -1
+long bench_alloc(unsigned long n);
+void bench_free(long idx, unsigned long n);
+unsigned long bench_nr_free(void);
+
+#endif /* !__TOOLS_BENCH_BENCH_H__ */
@@ -0,0 +1,80 @@
+#include <pmm.h>
+#include <default_pmm.h>
+#include <best_fit_pmm.h>
+#include <best_fit_seg_pmm.h>
+#include <buddy_pmm.h>
+#include <buddy_list_pmm.h>
+#include <slub_pmm.h>
+#include <bitmap_pmm.h>
+#include <kmalloc.h>
+#include "bench.h"
+
+/* *
+ * Kernel-side half of the host benchmark: it provides what pmm.c provides
+ * in the kernel (pages[], the pmm_manager and the alloc_pages family) so
+ * the manager sources link unchanged, with "physical memory" being a host
+ * buffer that va_pa_offset maps onto DRAM_BASE.
+ * */
+
+struct Page *pages;
+size_t npage = 0;
+const size_t nbase = DRAM_BASE / PGSIZE;
+uint64_t va_pa_offset;
+const struct pmm_manager *pmm_manager;
+
+// the same names pmm=<name> takes on the kernel command line
+static const struct {
+    const char *name;
+    const struct pmm_manager *manager;
+} bench_managers[] = {
+    {"default", &default_pmm_manager},
+    {"best_fit", &best_fit_pmm_manager},
+    {"best_fit_seg", &best_fit_seg_pmm_manager},
+    {"buddy", &buddy_pmm_manager},
+    {"buddy_list", &buddy_list_pmm_manager},
+    {"slub", &slub_pmm_manager},
+    {"bitmap", &bitmap_pmm_manager},
+};
+
+struct Page *alloc_pages(size_t n) { return pmm_manager->alloc_pages(n); }
+
+void free_pages(struct Page *base, size_t n) { pmm_manager->free_pages(base, n); }
+
+size_t nr_free_pages(void) { return pmm_manager->nr_free_pages(); }
+
+// the managers' check() hooks end with the in-kernel benchmark; the host
+// driver measures them itself
+void pmm_bench(void) {}
+
+int bench_nr_managers(void) {
+    return sizeof(bench_managers) / sizeof(bench_managers[0]);
+}
+
+const char *bench_manager_name(int mgr) { return bench_managers[mgr].name; }
+
+unsigned long bench_page_struct_size(void) { return sizeof(struct Page); }
+
+void bench_setup(int mgr, void *page_array, void *mem, unsigned long n) {
+    pages = page_array;
+    npage = nbase + n;
+    va_pa_offset = (uintptr_t)mem - DRAM_BASE;
+    for (size_t i = 0; i < n; i ++) {
+        SetPageReserved(pages + i);
+    }
+    pmm_manager = bench_managers[mgr].manager;
+    pmm_manager->init();
+    pmm_manager->init_memmap(pages, n);
+    // as in pmm_init, the kernel heap starts on top of the page allocator
+    kmem_init();
+}
+
+void bench_check(void) { pmm_manager->check(); }
+
+long bench_alloc(unsigned long n) {
+    struct Page *page = alloc_pages(n);
+    return page != NULL ? page - pages : -1;
+}
+
+void bench_free(long idx, unsigned long n) { free_pages(pages + idx, n); }
+
+unsigned long bench_nr_free(void) { return nr_free_pages(); }
@@ -4,6 +4,7 @@
 #include <trap.h>
 #include <kmonitor.h>
 #include <kdebug.h>
+#include <pmm.h>
 
 /* *
  * Simple command-line kernel monitor useful for controlling the
@@ -21,6 +22,7 @@ static struct command commands[] = {
     {"help", "Display this list of commands.", mon_help},
     {"kerninfo", "Display information about the kernel.", mon_kerninfo},
     {"backtrace", "Print backtrace of stack frame.", mon_backtrace},
+    {"pmm", "Display free memory and fragmentation statistics.", mon_pmm},
 };
 
 /* return if kernel is panic, in kern/debug/panic.c */
@@ -130,3 +132,12 @@ mon_backtrace(int argc, char **argv, struct trapframe *tf) {
     return 0;
 }
 
+/* *
+ * mon_pmm - call print_pmm_stats in kern/mm/pmm.c to print the free block
+ * histogram and fragmentation index of the current pmm_manager.
+ * */
+int
+mon_pmm(int argc, char **argv, struct trapframe *tf) {
+    print_pmm_stats();
+    return 0;
+}
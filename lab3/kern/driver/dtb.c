@@ -1,101 +1,121 @@
 #include <dtb.h>
+#include <fdt.h>
 #include <stdio.h>
 #include <string.h>
 #include <defs.h>
 #include <memlayout.h>
 
-// 设备树头部结构
-struct fdt_header {
-    uint32_t magic;          // 0xd00dfeed (big-endian)
-    uint32_t totalsize;      // 整个DTB的大小
-    uint32_t off_dt_struct;  // 结构体部分的偏移
-    uint32_t off_dt_strings; // 字符串部分的偏移
-    uint32_t off_mem_rsvmap; // 内存保留映射的偏移
-    uint32_t version;        // DTB版本
-    uint32_t last_comp_version; // 最后兼容版本
-    uint32_t boot_cpuid_phys;   // 启动CPU的物理ID
-    uint32_t size_dt_strings;   // 字符串部分大小
-    uint32_t size_dt_struct;    // 结构体部分大小
-};
+// 从/chosen节点复制出的内核命令行
+#define BOOTARGS_MAX    256
+static char bootargs[BOOTARGS_MAX];
 
-// FDT token定义
-#define FDT_BEGIN_NODE  0x00000001
-#define FDT_END_NODE    0x00000002
-#define FDT_PROP        0x00000003
-#define FDT_NOP         0x00000004
-#define FDT_END         0x00000009
+// 从DTB收集的内存区间：各memory节点的reg，/reserved-memory子节点的reg
+// 以及mem-rsvmap中的保留区；可用区间为前者减去后两者，按地址排序
+static struct mem_region memory_regions[MEM_REGIONS_MAX];
+static int nr_memory_regions = 0;
+static struct mem_region reserved_regions[MEM_REGIONS_MAX];
+static int nr_reserved_regions = 0;
+static struct mem_region usable_regions[MEM_REGIONS_MAX];
+static int nr_usable_regions = 0;
 
-// 字节序转换函数
-static uint32_t fdt32_to_cpu(uint32_t x) {
-    return ((x & 0xff) << 24) | (((x >> 8) & 0xff) << 16) | 
-           (((x >> 16) & 0xff) << 8) | ((x >> 24) & 0xff);
+static void add_region(struct mem_region *table, int *count, uint64_t base, uint64_t size) {
+    if (size == 0) {
+        return;
+    }
+    if (*count == MEM_REGIONS_MAX) {
+        cprintf("Warning: DTB region [0x%lx, 0x%lx) ignored, table full\n", base, base + size);
+        return;
+    }
+    table[*count].base = base;
+    table[*count].size = size;
+    (*count)++;
 }
 
-static uint64_t fdt64_to_cpu(uint64_t x) {
-    return ((uint64_t)fdt32_to_cpu(x & 0xffffffff) << 32) | 
-           fdt32_to_cpu(x >> 32);
+// 把节点reg属性中的每个(地址, 长度)对加入table
+static void add_reg_regions(struct mem_region *table, int *count, int node) {
+    uint64_t base, size;
+    for (int i = 0; fdt_reg(node, i, &base, &size) == 0; i++) {
+        add_region(table, count, base, size);
+    }
 }
 
-// 简化的内存信息提取函数
-static int extract_memory_info(uintptr_t dtb_vaddr, const struct fdt_header *header, 
-                              uint64_t *mem_base, uint64_t *mem_size) {
-    uint32_t struct_offset = fdt32_to_cpu(header->off_dt_struct);
-    uint32_t strings_offset = fdt32_to_cpu(header->off_dt_strings);
+// 从设备树索引中取出内存区间、保留区与/chosen/bootargs
+static int extract_memory_info(void) {
+    // 根节点下的memory节点（memory或memory@...），reg可以列出多个内存区间
+    for (int node = fdt_first_child(0); node >= 0; node = fdt_next_sibling(node)) {
+        const char *name = fdt_node_name(node);
+        if (strncmp(name, "memory", 6) == 0 && (name[6] == '\0' || name[6] == '@')) {
+            add_reg_regions(memory_regions, &nr_memory_regions, node);
+        }
+    }
+    
+    // reserved-memory的子节点用reg给出固定的保留区（只有size的动态保留区忽略）
+    int rsv = fdt_find_path("/reserved-memory");
+    for (int node = fdt_first_child(rsv); node >= 0; node = fdt_next_sibling(node)) {
+        add_reg_regions(reserved_regions, &nr_reserved_regions, node);
+    }
     
-    const char *strings_base = (const char *)(dtb_vaddr + strings_offset);
-    const uint32_t *struct_ptr = (const uint32_t *)(dtb_vaddr + struct_offset);
+    // mem-rsvmap中的保留区
+    for (int i = 0; i < fdt_nr_mem_rsv(); i++) {
+        uint64_t base, size;
+        fdt_get_mem_rsv(i, &base, &size);
+        add_region(reserved_regions, &nr_reserved_regions, base, size);
+    }
     
-    int in_memory_node = 0;
+    // 在chosen节点中查找bootargs属性，过长的部分截断
+    uint32_t len;
+    const char *args = fdt_getprop(fdt_find_path("/chosen"), "bootargs", &len);
+    if (args != NULL) {
+        size_t n = strnlen(args, len);
+        if (n >= BOOTARGS_MAX) {
+            n = BOOTARGS_MAX - 1;
+        }
+        memcpy(bootargs, args, n);
+        bootargs[n] = '\0';
+    }
     
-    while (1) {
-        uint32_t token = fdt32_to_cpu(*struct_ptr++);
-        
-        switch (token) {
-            case FDT_BEGIN_NODE: {
-                const char *name = (const char *)struct_ptr;
-                int name_len = strlen(name);
-                
-                // 检查是否是memory节点
-                if (strncmp(name, "memory", 6) == 0) {
-                    in_memory_node = 1;
+    return nr_memory_regions > 0 ? 0 : -1; // 是否找到memory节点
+}
+
+// 计算可用区间：memory区间按地址排序，再逐个挖去保留区
+static void build_usable_regions(void) {
+    nr_usable_regions = 0;
+    for (int i = 0; i < nr_memory_regions; i++) {
+        int j = nr_usable_regions++;
+        for (; j > 0 && usable_regions[j - 1].base > memory_regions[i].base; j--) {
+            usable_regions[j] = usable_regions[j - 1];
+        }
+        usable_regions[j] = memory_regions[i];
+    }
+    for (int r = 0; r < nr_reserved_regions; r++) {
+        uint64_t rbase = reserved_regions[r].base;
+        uint64_t rend = rbase + reserved_regions[r].size;
+        for (int i = 0; i < nr_usable_regions; i++) {
+            uint64_t base = usable_regions[i].base;
+            uint64_t end = base + usable_regions[i].size;
+            if (rend <= base || end <= rbase) {
+                continue;
+            }
+            // 保留区之后剩下的部分作为新区间插在其后
+            if (rend < end && nr_usable_regions < MEM_REGIONS_MAX) {
+                for (int j = nr_usable_regions++; j > i + 1; j--) {
+                    usable_regions[j] = usable_regions[j - 1];
                 }
-                
-                // 跳过节点名（4字节对齐）
-                struct_ptr = (const uint32_t *)(((uintptr_t)struct_ptr + name_len + 4) & ~3);
-                break;
+                usable_regions[i + 1].base = rend;
+                usable_regions[i + 1].size = end - rend;
+            } else if (rend < end) {
+                cprintf("Warning: DTB region [0x%lx, 0x%lx) dropped, table full\n", rend, end);
             }
-            
-            case FDT_END_NODE:
-                in_memory_node = 0;
-                break;
-                
-            case FDT_PROP: {
-                uint32_t prop_len = fdt32_to_cpu(*struct_ptr++);
-                uint32_t prop_nameoff = fdt32_to_cpu(*struct_ptr++);
-                const char *prop_name = strings_base + prop_nameoff;
-                const void *prop_data = struct_ptr;
-                
-                // 在memory节点中查找reg属性
-                if (in_memory_node && strcmp(prop_name, "reg") == 0 && prop_len >= 16) {
-                    const uint64_t *reg_data = (const uint64_t *)prop_data;
-                    *mem_base = fdt64_to_cpu(reg_data[0]);
-                    *mem_size = fdt64_to_cpu(reg_data[1]);
-                    return 0; // 成功找到
+            // 保留区之前剩下的部分留在原处，为空则删去
+            if (base < rbase) {
+                usable_regions[i].size = rbase - base;
+            } else {
+                for (int j = i; j + 1 < nr_usable_regions; j++) {
+                    usable_regions[j] = usable_regions[j + 1];
                 }
-                
-                // 跳过属性数据（4字节对齐）
-                struct_ptr = (const uint32_t *)(((uintptr_t)struct_ptr + prop_len + 3) & ~3);
-                break;
+                nr_usable_regions--;
+                i--;
             }
-            
-            case FDT_NOP:
-                break;
-                
-            case FDT_END:
-                return -1; // 没有找到
-                
-            default:
-                return -1; // 错误
         }
     }
 }
@@ -116,28 +136,56 @@ void dtb_init(void) {
     
     // 转换为虚拟地址
     uintptr_t dtb_vaddr = boot_dtb + PHYSICAL_MEMORY_OFFSET;
-    const struct fdt_header *header = (const struct fdt_header *)dtb_vaddr;
     
     // 验证DTB
-    uint32_t magic = fdt32_to_cpu(header->magic);
-    if (magic != 0xd00dfeed) {
+    uint32_t magic = fdt32_to_cpu(*(const uint32_t *)dtb_vaddr);
+    if (magic != FDT_MAGIC) {
         cprintf("Error: Invalid DTB magic number: 0x%x\n", magic);
         return;
     }
     
+    // 建立设备树索引，之后的查找不再重新扫描DTB
+    int ret = fdt_init((const void *)dtb_vaddr);
+    if (ret != 0) {
+        cprintf("Error: Could not index DTB (%d)\n", ret);
+        return;
+    }
+    cprintf("DTB indexed: %d nodes\n", fdt_nr_nodes());
+    check_fdt();
+    
     // 提取内存信息
-    uint64_t mem_base, mem_size;
-    if (extract_memory_info(dtb_vaddr, header, &mem_base, &mem_size) == 0) {
+    if (extract_memory_info() == 0) {
+        // 索引指向DTB本身，DTB所在内存也要保留
+        add_region(reserved_regions, &nr_reserved_regions, boot_dtb, fdt_totalsize());
+        build_usable_regions();
         cprintf("Physical Memory from DTB:\n");
-        cprintf("  Base: 0x%016lx\n", mem_base);
-        cprintf("  Size: 0x%016lx (%ld MB)\n", mem_size, mem_size / (1024 * 1024));
-        cprintf("  End:  0x%016lx\n", mem_base + mem_size - 1);
-        // 保存到全局变量，供 PMM 查询
-        memory_base = mem_base;
-        memory_size = mem_size;
+        for (int i = 0; i < nr_memory_regions; i++) {
+            cprintf("  Memory:   [0x%016lx, 0x%016lx] (%ld MB)\n", memory_regions[i].base,
+                    memory_regions[i].base + memory_regions[i].size - 1,
+                    memory_regions[i].size / (1024 * 1024));
+        }
+        for (int i = 0; i < nr_reserved_regions; i++) {
+            cprintf("  Reserved: [0x%016lx, 0x%016lx]\n", reserved_regions[i].base,
+                    reserved_regions[i].base + reserved_regions[i].size - 1);
+        }
+        // 保存到全局变量，供 PMM 查询：第一个区间的起点到最后一个区间的终点
+        memory_base = memory_regions[0].base;
+        uint64_t mem_end = 0;
+        for (int i = 0; i < nr_memory_regions; i++) {
+            if (memory_regions[i].base < memory_base) {
+                memory_base = memory_regions[i].base;
+            }
+            if (memory_regions[i].base + memory_regions[i].size > mem_end) {
+                mem_end = memory_regions[i].base + memory_regions[i].size;
+            }
+        }
+        memory_size = mem_end - memory_base;
     } else {
         cprintf("Warning: Could not extract memory info from DTB\n");
     }
+    if (bootargs[0] != '\0') {
+        cprintf("Bootargs: %s\n", bootargs);
+    }
     cprintf("DTB init completed\n");
 }
 
@@ -148,3 +196,35 @@ uint64_t get_memory_base(void) {
 uint64_t get_memory_size(void) {
     return memory_size;
 }
+
+// get_memory_regions - 返回可用内存区间表及其项数
+int get_memory_regions(const struct mem_region **regions) {
+    *regions = usable_regions;
+    return nr_usable_regions;
+}
+
+const char *get_bootargs(void) {
+    return bootargs;
+}
+
+// get_bootarg - 在命令行中查找"key=value"，返回value并通过len给出其长度，
+// 没有该参数时返回NULL
+const char *get_bootarg(const char *key, size_t *len) {
+    size_t klen = strlen(key);
+    const char *p = bootargs;
+    while (*p != '\0') {
+        while (*p == ' ') {
+            p++;
+        }
+        const char *end = p;
+        while (*end != '\0' && *end != ' ') {
+            end++;
+        }
+        if ((size_t)(end - p) > klen && strncmp(p, key, klen) == 0 && p[klen] == '=') {
+            *len = end - p - klen - 1;
+            return p + klen + 1;
+        }
+        p = end;
+    }
+    return NULL;
+}
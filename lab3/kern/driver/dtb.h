@@ -7,8 +7,21 @@
 extern uint64_t boot_hartid;
 extern uint64_t boot_dtb;
 
+#define MEM_REGIONS_MAX 16
+
+// a range of physical memory, [base, base + size)
+struct mem_region {
+    uint64_t base;
+    uint64_t size;
+};
+
 void dtb_init(void);
-uint64_t get_memory_base(void);
-uint64_t get_memory_size(void);
+uint64_t get_memory_base(void);     // lowest address of any memory node
+uint64_t get_memory_size(void);     // span from there to the highest end
+// RAM from every memory node less /reserved-memory and the mem-rsvmap,
+// sorted by address; returns the number of regions
+int get_memory_regions(const struct mem_region **regions);
+const char *get_bootargs(void);
+const char *get_bootarg(const char *key, size_t *len);
 
 #endif /* !__KERN_DRIVER_DTB_H__ */
@@ -0,0 +1,482 @@
+#include <fdt.h>
+#include <assert.h>
+#include <defs.h>
+#include <error.h>
+#include <stdio.h>
+#include <string.h>
+
+struct fdt_header {
+    uint32_t magic;             // FDT_MAGIC
+    uint32_t totalsize;         // size of the whole blob
+    uint32_t off_dt_struct;     // offset of the structure block
+    uint32_t off_dt_strings;    // offset of the strings block
+    uint32_t off_mem_rsvmap;    // offset of the memory reservation block
+    uint32_t version;
+    uint32_t last_comp_version;
+    uint32_t boot_cpuid_phys;
+    uint32_t size_dt_strings;
+    uint32_t size_dt_struct;
+};
+
+// structure block tokens
+#define FDT_BEGIN_NODE  0x00000001
+#define FDT_END_NODE    0x00000002
+#define FDT_PROP        0x00000003
+#define FDT_NOP         0x00000004
+#define FDT_END         0x00000009
+
+struct fdt_prop {
+    const char *name;
+    const void *data;
+    uint32_t len;
+};
+
+struct fdt_node {
+    const char *name;
+    int parent, first_child, next_sibling;
+    int first_prop, nr_props;           // a slice of props[]
+    uint32_t phandle;
+    int addr_cells, size_cells;         // what this node gives its children
+    const uint32_t *reg;                // the properties drivers look up most
+    uint32_t reg_len;
+    const uint32_t *interrupts;
+    uint32_t interrupts_len;
+    const char *compatible;
+    uint32_t compatible_len;
+};
+
+// one string of a compatible list, or one phandle, and the node it names
+struct fdt_compat_entry {
+    const char *compat;
+    int node;
+};
+
+struct fdt_phandle_entry {
+    uint32_t phandle;
+    int node;
+};
+
+static const struct fdt_header *fdt;
+static struct fdt_node nodes[FDT_MAX_NODES];
+static int nr_nodes = 0;
+static struct fdt_prop props[FDT_MAX_PROPS];
+static int nr_props = 0;
+static struct fdt_compat_entry compat_index[FDT_MAX_COMPATIBLE];   // by string, then node
+static int nr_compat = 0;
+static struct fdt_phandle_entry phandle_index[FDT_MAX_NODES];       // by phandle
+static int nr_phandles = 0;
+static const uint64_t *mem_rsvmap;
+static int nr_mem_rsv = 0;
+
+static inline bool valid_node(int node) {
+    return node >= 0 && node < nr_nodes;
+}
+
+static int compat_cmp(const char *compat, int node, const struct fdt_compat_entry *e) {
+    int c = strcmp(compat, e->compat);
+    return c != 0 ? c : node - e->node;
+}
+
+// index_node_props - pick the properties of node that the lookups use
+static int index_node_props(int node) {
+    struct fdt_node *n = &nodes[node];
+    for (int i = n->first_prop; i < n->first_prop + n->nr_props; i++) {
+        const char *name = props[i].name;
+        const uint32_t *data = props[i].data;
+        uint32_t len = props[i].len;
+        if (strcmp(name, "reg") == 0) {
+            n->reg = data, n->reg_len = len;
+        } else if (strcmp(name, "interrupts") == 0) {
+            n->interrupts = data, n->interrupts_len = len;
+        } else if (strcmp(name, "#address-cells") == 0 && len == 4) {
+            n->addr_cells = fdt32_to_cpu(*data);
+        } else if (strcmp(name, "#size-cells") == 0 && len == 4) {
+            n->size_cells = fdt32_to_cpu(*data);
+        } else if ((strcmp(name, "phandle") == 0 || strcmp(name, "linux,phandle") == 0) &&
+                   len == 4) {
+            n->phandle = fdt32_to_cpu(*data);
+        } else if (strcmp(name, "compatible") == 0) {
+            n->compatible = (const char *)data, n->compatible_len = len;
+        }
+    }
+
+    // keep both tables sorted as entries come in: nodes are few
+    if (n->phandle != 0) {
+        int j = nr_phandles++;
+        for (; j > 0 && phandle_index[j - 1].phandle > n->phandle; j--) {
+            phandle_index[j] = phandle_index[j - 1];
+        }
+        phandle_index[j].phandle = n->phandle;
+        phandle_index[j].node = node;
+    }
+    for (uint32_t off = 0; off < n->compatible_len;) {
+        const char *s = n->compatible + off;
+        if (nr_compat == FDT_MAX_COMPATIBLE) {
+            return -E_NO_MEM;
+        }
+        int j = nr_compat++;
+        for (; j > 0 && compat_cmp(s, node, &compat_index[j - 1]) < 0; j--) {
+            compat_index[j] = compat_index[j - 1];
+        }
+        compat_index[j].compat = s;
+        compat_index[j].node = node;
+        off += strnlen(s, n->compatible_len - off) + 1;
+    }
+    return 0;
+}
+
+// fdt_init - index the blob: one pass over the structure block
+int fdt_init(const void *blob) {
+    const struct fdt_header *header = blob;
+    if (fdt32_to_cpu(header->magic) != FDT_MAGIC) {
+        return -E_INVAL;
+    }
+    const char *strings = (const char *)blob + fdt32_to_cpu(header->off_dt_strings);
+    const uint32_t *p = (const uint32_t *)((const char *)blob + fdt32_to_cpu(header->off_dt_struct));
+    int stack[FDT_MAX_DEPTH];           // open nodes, the innermost on top
+    int last_child[FDT_MAX_DEPTH + 1];  // last child seen at each depth
+    int depth = 0;
+
+    fdt = NULL;
+    nr_nodes = nr_props = nr_compat = nr_phandles = 0;
+    last_child[0] = -1;
+    while (1) {
+        uint32_t token = fdt32_to_cpu(*p++);
+        switch (token) {
+        case FDT_BEGIN_NODE: {
+            const char *name = (const char *)p;
+            if (nr_nodes == FDT_MAX_NODES || depth == FDT_MAX_DEPTH) {
+                return -E_NO_MEM;
+            }
+            int node = nr_nodes++, parent = depth > 0 ? stack[depth - 1] : -1;
+            struct fdt_node *n = &nodes[node];
+            memset(n, 0, sizeof(*n));
+            n->name = name;
+            n->parent = parent;
+            n->first_child = n->next_sibling = -1;
+            n->first_prop = nr_props;
+            n->addr_cells = 2;      // the defaults the specification gives
+            n->size_cells = 1;
+            if (last_child[depth] >= 0) {
+                nodes[last_child[depth]].next_sibling = node;
+            } else if (parent >= 0) {
+                nodes[parent].first_child = node;
+            }
+            last_child[depth] = node;
+            stack[depth++] = node;
+            last_child[depth] = -1;
+            p = (const uint32_t *)(((uintptr_t)p + strlen(name) + 4) & ~3);
+            break;
+        }
+        case FDT_END_NODE:
+            if (depth == 0 || index_node_props(stack[--depth]) != 0) {
+                return depth == 0 ? -E_INVAL : -E_NO_MEM;
+            }
+            break;
+        case FDT_PROP: {
+            uint32_t len = fdt32_to_cpu(*p++);
+            uint32_t nameoff = fdt32_to_cpu(*p++);
+            // properties come before the subnodes, so a node's are contiguous
+            if (depth == 0 || nr_props == FDT_MAX_PROPS) {
+                return depth == 0 ? -E_INVAL : -E_NO_MEM;
+            }
+            props[nr_props].name = strings + nameoff;
+            props[nr_props].data = p;
+            props[nr_props].len = len;
+            nr_props++;
+            nodes[stack[depth - 1]].nr_props++;
+            p = (const uint32_t *)(((uintptr_t)p + len + 3) & ~3);
+            break;
+        }
+        case FDT_NOP:
+            break;
+        case FDT_END:
+            if (depth != 0 || nr_nodes == 0) {
+                return -E_INVAL;
+            }
+            mem_rsvmap = (const uint64_t *)((const char *)blob + fdt32_to_cpu(header->off_mem_rsvmap));
+            for (nr_mem_rsv = 0; mem_rsvmap[2 * nr_mem_rsv] != 0 || mem_rsvmap[2 * nr_mem_rsv + 1] != 0;) {
+                nr_mem_rsv++;
+            }
+            fdt = header;
+            return 0;
+        default:
+            return -E_INVAL;
+        }
+    }
+}
+
+uint32_t fdt_totalsize(void) {
+    return fdt != NULL ? fdt32_to_cpu(fdt->totalsize) : 0;
+}
+
+int fdt_nr_nodes(void) {
+    return fdt != NULL ? nr_nodes : 0;
+}
+
+const char *fdt_node_name(int node) {
+    return valid_node(node) ? nodes[node].name : NULL;
+}
+
+int fdt_parent(int node) {
+    return valid_node(node) ? nodes[node].parent : -1;
+}
+
+int fdt_first_child(int node) {
+    return valid_node(node) ? nodes[node].first_child : -1;
+}
+
+int fdt_next_sibling(int node) {
+    return valid_node(node) ? nodes[node].next_sibling : -1;
+}
+
+uint32_t fdt_phandle(int node) {
+    return valid_node(node) ? nodes[node].phandle : 0;
+}
+
+// fdt_get_path - write the full path of node to buf, e.g. "/soc/uart@10000000"
+int fdt_get_path(int node, char *buf, size_t len) {
+    int chain[FDT_MAX_DEPTH], depth = 0;
+    if (!valid_node(node)) {
+        return -E_INVAL;
+    }
+    for (; node > 0; node = nodes[node].parent) {
+        chain[depth++] = node;
+    }
+    size_t pos = 0;
+    do {
+        const char *name = depth > 0 ? nodes[chain[--depth]].name : "";
+        size_t n = strlen(name);
+        if (pos + 1 + n + 1 > len) {
+            return -E_INVAL;
+        }
+        buf[pos++] = '/';
+        memcpy(buf + pos, name, n);
+        pos += n;
+    } while (depth > 0);
+    buf[pos] = '\0';
+    return pos;
+}
+
+const void *fdt_getprop(int node, const char *name, uint32_t *len) {
+    if (!valid_node(node)) {
+        return NULL;
+    }
+    struct fdt_node *n = &nodes[node];
+    for (int i = n->first_prop; i < n->first_prop + n->nr_props; i++) {
+        if (strcmp(props[i].name, name) == 0) {
+            if (len != NULL) {
+                *len = props[i].len;
+            }
+            return props[i].data;
+        }
+    }
+    return NULL;
+}
+
+// read_cells - a number made of ncells big-endian cells, the low 64 bits of it
+static uint64_t read_cells(const uint32_t *p, int ncells) {
+    uint64_t x = 0;
+    for (int i = 0; i < ncells; i++) {
+        x = (x << 32) | fdt32_to_cpu(p[i]);
+    }
+    return x;
+}
+
+// fdt_reg - the i-th (base, size) pair of node's reg
+int fdt_reg(int node, int i, uint64_t *base, uint64_t *size) {
+    if (!valid_node(node) || node == 0) {
+        return -E_INVAL;
+    }
+    const struct fdt_node *parent = &nodes[nodes[node].parent];
+    uint32_t entry = (parent->addr_cells + parent->size_cells) * 4;
+    if (entry == 0 || (uint64_t)(i + 1) * entry > nodes[node].reg_len) {
+        return -E_INVAL;
+    }
+    const uint32_t *p = nodes[node].reg + i * entry / 4;
+    *base = read_cells(p, parent->addr_cells);
+    *size = read_cells(p + parent->addr_cells, parent->size_cells);
+    return 0;
+}
+
+const uint32_t *fdt_interrupts(int node, uint32_t *ncells) {
+    if (!valid_node(node) || nodes[node].interrupts == NULL) {
+        return NULL;
+    }
+    *ncells = nodes[node].interrupts_len / 4;
+    return nodes[node].interrupts;
+}
+
+// compat_has - whether the compatible list [list, list + len) holds compat
+static bool compat_has(const char *list, uint32_t len, const char *compat) {
+    for (uint32_t off = 0; off < len; off += strnlen(list + off, len - off) + 1) {
+        if (strcmp(list + off, compat) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+bool fdt_is_compatible(int node, const char *compat) {
+    return valid_node(node) &&
+           compat_has(nodes[node].compatible, nodes[node].compatible_len, compat);
+}
+
+// name_matches - whether a node name is the len bytes at component, with or
+// without its unit address
+static bool name_matches(const char *name, const char *component, size_t len) {
+    if (strncmp(name, component, len) != 0) {
+        return 0;
+    }
+    if (name[len] == '\0') {
+        return 1;
+    }
+    // "memory" finds "memory@80000000", "memory@8" does not
+    for (size_t i = 0; i < len; i++) {
+        if (component[i] == '@') {
+            return 0;
+        }
+    }
+    return name[len] == '@';
+}
+
+int fdt_find_path(const char *path) {
+    if (fdt == NULL || path[0] != '/') {
+        return -1;
+    }
+    int node = 0;
+    while (*path != '\0') {
+        while (*path == '/') {
+            path++;
+        }
+        if (*path == '\0') {
+            break;
+        }
+        const char *end = path;
+        while (*end != '\0' && *end != '/') {
+            end++;
+        }
+        int child = nodes[node].first_child;
+        while (child >= 0 && !name_matches(nodes[child].name, path, end - path)) {
+            child = nodes[child].next_sibling;
+        }
+        if (child < 0) {
+            return -1;
+        }
+        node = child;
+        path = end;
+    }
+    return node;
+}
+
+int fdt_find_phandle(uint32_t phandle) {
+    int lo = 0, hi = nr_phandles;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (phandle_index[mid].phandle < phandle) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < nr_phandles && phandle_index[lo].phandle == phandle ? phandle_index[lo].node : -1;
+}
+
+int fdt_find_compatible(const char *compat, int from) {
+    int lo = 0, hi = nr_compat;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (compat_cmp(compat, from + 1, &compat_index[mid]) > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < nr_compat && strcmp(compat_index[lo].compat, compat) == 0 ? compat_index[lo].node : -1;
+}
+
+int fdt_nr_mem_rsv(void) {
+    return fdt != NULL ? nr_mem_rsv : 0;
+}
+
+int fdt_get_mem_rsv(int i, uint64_t *base, uint64_t *size) {
+    if (i < 0 || i >= fdt_nr_mem_rsv()) {
+        return -E_INVAL;
+    }
+    *base = fdt64_to_cpu(mem_rsvmap[2 * i]);
+    *size = fdt64_to_cpu(mem_rsvmap[2 * i + 1]);
+    return 0;
+}
+
+// check_fdt - walk the structure block once more without the index, token
+// by token, and check the lookups against what that walk finds: the root,
+// the first memory node by path and its first reg pair, the first clint and
+// uart by compatible, and every phandle
+void check_fdt(void) {
+    assert(fdt != NULL);
+    const char *strings = (const char *)fdt + fdt32_to_cpu(fdt->off_dt_strings);
+    const uint32_t *p = (const uint32_t *)((const char *)fdt + fdt32_to_cpu(fdt->off_dt_struct));
+    int node = -1, depth = 0, mem = -1, clint = -1, uart = -1;
+    int addr_cells = 2, size_cells = 1;     // the root's
+    const char *mem_name = NULL;
+    const uint32_t *mem_reg = NULL;
+    uint32_t mem_reg_len = 0, token;
+
+    while ((token = fdt32_to_cpu(*p++)) != FDT_END) {
+        if (token == FDT_BEGIN_NODE) {
+            const char *name = (const char *)p;
+            node++, depth++;
+            if (depth == 2 && mem < 0 && strncmp(name, "memory", 6) == 0 &&
+                (name[6] == '\0' || name[6] == '@')) {
+                mem = node, mem_name = name;
+            }
+            p = (const uint32_t *)(((uintptr_t)p + strlen(name) + 4) & ~3);
+        } else if (token == FDT_END_NODE) {
+            depth--;
+        } else if (token == FDT_PROP) {
+            uint32_t len = fdt32_to_cpu(*p++);
+            const char *name = strings + fdt32_to_cpu(*p++);
+            if (depth == 1 && strcmp(name, "#address-cells") == 0) {
+                addr_cells = fdt32_to_cpu(*p);
+            } else if (depth == 1 && strcmp(name, "#size-cells") == 0) {
+                size_cells = fdt32_to_cpu(*p);
+            } else if (node == mem && strcmp(name, "reg") == 0) {
+                mem_reg = p, mem_reg_len = len;
+            } else if (strcmp(name, "compatible") == 0) {
+                if (clint < 0 && compat_has((const char *)p, len, "riscv,clint0")) {
+                    clint = node;
+                }
+                if (uart < 0 && compat_has((const char *)p, len, "ns16550a")) {
+                    uart = node;
+                }
+            } else if (strcmp(name, "phandle") == 0 && len == 4) {
+                assert(fdt_find_phandle(fdt32_to_cpu(*p)) == node);
+                assert(fdt_phandle(node) == fdt32_to_cpu(*p));
+            }
+            p = (const uint32_t *)(((uintptr_t)p + len + 3) & ~3);
+        } else {
+            assert(token == FDT_NOP);
+        }
+    }
+    assert(depth == 0 && node + 1 == fdt_nr_nodes());
+
+    assert(fdt_find_path("/") == 0 && fdt_parent(0) == -1);
+    if (mem >= 0) {
+        char path[64] = "/";
+        assert(strlen(mem_name) + 2 <= sizeof(path));
+        strcpy(path + 1, mem_name);
+        assert(fdt_find_path(path) == mem);
+        uint64_t base, size;
+        if ((uint32_t)(addr_cells + size_cells) * 4 <= mem_reg_len) {
+            assert(fdt_reg(mem, 0, &base, &size) == 0);
+            assert(base == read_cells(mem_reg, addr_cells));
+            assert(size == read_cells(mem_reg + addr_cells, size_cells));
+        } else {
+            assert(fdt_reg(mem, 0, &base, &size) != 0);
+        }
+    }
+    assert(fdt_find_compatible("riscv,clint0", -1) == clint);
+    assert(fdt_find_compatible("ns16550a", -1) == uart);
+    cprintf("check_fdt() succeeded!\n");
+}
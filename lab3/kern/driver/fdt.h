@@ -0,0 +1,64 @@
+#ifndef __KERN_DRIVER_FDT_H__
+#define __KERN_DRIVER_FDT_H__
+
+#include <defs.h>
+
+/* *
+ * Flattened device tree index. fdt_init walks the blob once and records
+ * every node and property in static tables that point back into it, so the
+ * blob has to stay where it is (dtb_init keeps the pmm off it). Nodes are
+ * numbered in the order they appear in the blob, the root being node 0;
+ * functions taking a node return -1, NULL or 0 for one that does not exist.
+ * */
+
+#define FDT_MAGIC           0xd00dfeed
+#define FDT_MAX_NODES       256     // nodes the index can hold
+#define FDT_MAX_PROPS       2048    // properties, over all nodes
+#define FDT_MAX_COMPATIBLE  512     // strings in compatible lists, over all nodes
+#define FDT_MAX_DEPTH       16      // nesting of nodes, the root at depth 1
+
+// the blob is big-endian
+static inline uint32_t fdt32_to_cpu(uint32_t x) {
+    return ((x & 0xff) << 24) | (((x >> 8) & 0xff) << 16) |
+           (((x >> 16) & 0xff) << 8) | ((x >> 24) & 0xff);
+}
+
+static inline uint64_t fdt64_to_cpu(uint64_t x) {
+    return ((uint64_t)fdt32_to_cpu(x & 0xffffffff) << 32) | fdt32_to_cpu(x >> 32);
+}
+
+int fdt_init(const void *blob);     // 0, -E_INVAL for a bad blob or -E_NO_MEM
+uint32_t fdt_totalsize(void);       // bytes taken by the indexed blob
+int fdt_nr_nodes(void);
+
+// the tree
+const char *fdt_node_name(int node);    // e.g. "memory@80000000", "" for the root
+int fdt_parent(int node);
+int fdt_first_child(int node);
+int fdt_next_sibling(int node);
+int fdt_get_path(int node, char *buf, size_t len);  // length, or -E_INVAL if buf is short
+uint32_t fdt_phandle(int node);
+
+// properties; reg is decoded with the #address-cells and #size-cells of the
+// parent, and returns -E_INVAL past its last (base, size) pair
+const void *fdt_getprop(int node, const char *name, uint32_t *len);
+int fdt_reg(int node, int i, uint64_t *base, uint64_t *size);
+const uint32_t *fdt_interrupts(int node, uint32_t *ncells);
+bool fdt_is_compatible(int node, const char *compat);
+
+// lookups: a path walks the tree from the root, a component without a unit
+// address matching a node with one; phandle and compatible are binary
+// searches in sorted tables
+int fdt_find_path(const char *path);
+int fdt_find_phandle(uint32_t phandle);
+// the first node after from (-1 to start) whose compatible list holds compat
+int fdt_find_compatible(const char *compat, int from);
+
+// the memory reservation block
+int fdt_nr_mem_rsv(void);
+int fdt_get_mem_rsv(int i, uint64_t *base, uint64_t *size);
+
+// check the index against a plain walk of the blob
+void check_fdt(void);
+
+#endif /* !__KERN_DRIVER_FDT_H__ */
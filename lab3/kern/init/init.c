@@ -35,9 +35,9 @@ int kern_init(void) {
     clock_init();   // init clock interrupt
     intr_enable();  // enable irq interrupt
 
-    /* do nothing */
+    /* do nothing but set up the rest of memory */
     while (1)
-        ;
+        pmm_init_deferred(1);
 }
 
 void __attribute__((noinline))
@@ -76,7 +76,7 @@ best_fit_init_memmap(struct Page *base, size_t n) {
         
     }
     base->property = n;
-    SetPageProperty(base);
+    __SetPageProperty(base);
     nr_free += n;
     if (list_empty(&free_list)) {
         list_add(&free_list, &(base->page_link));
@@ -115,11 +115,11 @@ best_fit_alloc_pages(size_t n) {
         if (page->property > n) {
             struct Page *p = page + n;
             p->property = page->property - n;
-            SetPageProperty(p);
+            __SetPageProperty(p);
             list_add(prev, &(p->page_link));
         }
         nr_free -= n;
-        ClearPageProperty(page);
+        __ClearPageProperty(page);
     }
     return page;
 }
@@ -162,7 +162,7 @@ best_fit_free_pages(struct Page *base, size_t n) {
         p = le2page(le, page_link);
         if (base + base->property == p) {
             base->property += p->property;
-            ClearPageProperty(p);
+            __ClearPageProperty(p);
             list_del(&(p->page_link));
         }
     }
@@ -173,6 +173,14 @@ best_fit_nr_free_pages(void) {
     return nr_free;
 }
 
+static void
+best_fit_stats(struct pmm_stats *st) {
+    list_entry_t *le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        pmm_stats_add_blocks(st, le2page(le, page_link)->property, 1);
+    }
+}
+
 static void
 basic_check(void) {
     struct Page *p0, *p1, *p2;
@@ -314,5 +322,6 @@ const struct pmm_manager best_fit_pmm_manager = {
     .free_pages = best_fit_free_pages,
     .nr_free_pages = best_fit_nr_free_pages,
     .check = best_fit_check,
+    .stats = best_fit_stats,
 };
 
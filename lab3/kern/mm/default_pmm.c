@@ -74,8 +74,7 @@ default_init_memmap(struct Page *base, size_t n) {
         p->flags = p->property = 0;
         set_page_ref(p, 0);
     }
-    base->property = n;
-    SetPageProperty(base);
+    set_block_tags(base, n);
     nr_free += n;
     if (list_empty(&free_list)) {
         list_add(&free_list, &(base->page_link));
@@ -87,42 +86,101 @@ default_init_memmap(struct Page *base, size_t n) {
                 list_add_before(le, &(base->page_link));
                 break;
             } else if (list_next(le) == &free_list) {
+                // appended: stop before the loop reaches base itself
                 list_add(le, &(base->page_link));
+                break;
             }
         }
     }
 }
 
+// breaks_huge_page - whether taking n pages from the head of the free block
+// p cuts into a whole huge page that the block holds
+static inline bool
+breaks_huge_page(struct Page *p, size_t n) {
+    size_t huge = ROUNDUP(page2ppn(p), HUGE_PAGE_NR) - page2ppn(p);
+    return huge < n && huge + HUGE_PAGE_NR <= p->property;
+}
+
+// default_alloc_pages - first fit, except that a request smaller than a huge
+// page passes over blocks where it would break one up, and only falls back
+// to the first of those when no other block fits
 static struct Page *
 default_alloc_pages(size_t n) {
     assert(n > 0);
     if (n > nr_free) {
         return NULL;
     }
-    struct Page *page = NULL;
+    struct Page *page = NULL, *fallback = NULL;
     list_entry_t *le = &free_list;
     while ((le = list_next(le)) != &free_list) {
         struct Page *p = le2page(le, page_link);
         if (p->property >= n) {
-            page = p;
-            break;
+            if (n >= HUGE_PAGE_NR || !breaks_huge_page(p, n)) {
+                page = p;
+                break;
+            }
+            if (fallback == NULL) {
+                fallback = p;
+            }
         }
     }
+    if (page == NULL) {
+        page = fallback;
+    }
     if (page != NULL) {
         list_entry_t* prev = list_prev(&(page->page_link));
         list_del(&(page->page_link));
         if (page->property > n) {
             struct Page *p = page + n;
-            p->property = page->property - n;
-            SetPageProperty(p);
+            set_block_tags(p, page->property - n);
             list_add(prev, &(p->page_link));
         }
         nr_free -= n;
-        ClearPageProperty(page);
+        __ClearPageProperty(page);
     }
     return page;
 }
 
+// carve_block - allocate [base, base + n) from inside the free block; what
+// is left before and after it stays free, in the block's place in the list
+static void
+carve_block(struct Page *block, struct Page *base, size_t n) {
+    struct Page *end = block + block->property;
+    list_entry_t *prev = list_prev(&(block->page_link));
+    list_del(&(block->page_link));
+    __ClearPageProperty(block);
+    if (base + n < end) {
+        set_block_tags(base + n, end - (base + n));
+        list_add(prev, &(base[n].page_link));
+    }
+    if (base > block) {
+        set_block_tags(block, base - block);
+        list_add(prev, &(block->page_link));
+    }
+    nr_free -= n;
+}
+
+// default_alloc_pages_aligned - first fit over the free blocks that hold n
+// pages starting at a page number that is a multiple of align
+static struct Page *
+default_alloc_pages_aligned(size_t n, size_t align) {
+    assert(n > 0 && (align & (align - 1)) == 0);
+    if (n > nr_free) {
+        return NULL;
+    }
+    list_entry_t *le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        struct Page *p = le2page(le, page_link);
+        struct Page *base = p + (ROUNDUP(page2ppn(p), align) - page2ppn(p));
+        if (base + n <= p + p->property) {
+            carve_block(p, base, n);
+            return base;
+        }
+    }
+    return NULL;
+}
+
 static void
 default_free_pages(struct Page *base, size_t n) {
     assert(n > 0);
@@ -132,45 +190,37 @@ default_free_pages(struct Page *base, size_t n) {
         p->flags = 0;
         set_page_ref(p, 0);
     }
-    base->property = n;
-    SetPageProperty(base);
     nr_free += n;
 
-    if (list_empty(&free_list)) {
-        list_add(&free_list, &(base->page_link));
-    } else {
-        list_entry_t* le = &free_list;
-        while ((le = list_next(le)) != &free_list) {
-            struct Page* page = le2page(le, page_link);
-            if (base < page) {
-                list_add_before(le, &(base->page_link));
-                break;
-            } else if (list_next(le) == &free_list) {
-                list_add(le, &(base->page_link));
-            }
-        }
+    // find the physical neighbours through the boundary tags; a merged block
+    // takes over the list position of the neighbour it absorbs, so the list
+    // stays address ordered without being walked
+    struct Page *prev = prev_free_block(base);
+    struct Page *next = next_free_block(base, n);
+    if (prev != NULL) {
+        n += prev->property;
+        base = prev;
+    } else if (next != NULL) {
+        list_add_before(&(next->page_link), &(base->page_link));
     }
-
-    list_entry_t* le = list_prev(&(base->page_link));
-    if (le != &free_list) {
-        p = le2page(le, page_link);
-        if (p + p->property == base) {
-            p->property += base->property;
-            ClearPageProperty(base);
-            list_del(&(base->page_link));
-            base = p;
-        }
+    if (next != NULL) {
+        n += next->property;
+        __ClearPageProperty(next);
+        list_del(&(next->page_link));
+    }
+    set_block_tags(base, n);
+    if (prev != NULL || next != NULL) {
+        return;
     }
 
-    le = list_next(&(base->page_link));
-    if (le != &free_list) {
-        p = le2page(le, page_link);
-        if (base + base->property == p) {
-            base->property += p->property;
-            ClearPageProperty(p);
-            list_del(&(p->page_link));
+    // no free neighbour: first fit needs the address order, so search for it
+    list_entry_t* le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        if (base < le2page(le, page_link)) {
+            break;
         }
     }
+    list_add_before(le, &(base->page_link));
 }
 
 static size_t
@@ -178,6 +228,43 @@ default_nr_free_pages(void) {
     return nr_free;
 }
 
+static void
+default_stats(struct pmm_stats *st) {
+    list_entry_t *le = &free_list;
+    while ((le = list_next(le)) != &free_list) {
+        pmm_stats_add_blocks(st, le2page(le, page_link)->property, 1);
+    }
+}
+
+// hold_free_blocks - allocate every free block whole, chained on held through
+// page_link, so the checks below see an empty manager. Merging follows the
+// physical neighbours, so the free blocks must really be taken rather than
+// just unlinked from free_list. carve_block takes each block itself, where
+// alloc_pages might pick another one to spare a huge page.
+static void
+hold_free_blocks(list_entry_t *held) {
+    list_init(held);
+    while (!list_empty(&free_list)) {
+        struct Page *p = le2page(list_next(&free_list), page_link);
+        size_t n = p->property;
+        carve_block(p, p, n);
+        p->property = n;
+        list_add_before(held, &(p->page_link));
+    }
+    assert(nr_free == 0);
+}
+
+// release_free_blocks - give back everything hold_free_blocks took
+static void
+release_free_blocks(list_entry_t *held) {
+    while (!list_empty(held)) {
+        list_entry_t *le = list_next(held);
+        list_del(le);
+        struct Page *p = le2page(le, page_link);
+        free_pages(p, p->property);
+    }
+}
+
 static void
 basic_check(void) {
     struct Page *p0, *p1, *p2;
@@ -193,13 +280,10 @@ basic_check(void) {
     assert(page2pa(p1) < npage * PGSIZE);
     assert(page2pa(p2) < npage * PGSIZE);
 
-    list_entry_t free_list_store = free_list;
-    list_init(&free_list);
+    list_entry_t held;
+    hold_free_blocks(&held);
     assert(list_empty(&free_list));
 
-    unsigned int nr_free_store = nr_free;
-    nr_free = 0;
-
     assert(alloc_page() == NULL);
 
     free_page(p0);
@@ -221,14 +305,36 @@ basic_check(void) {
     assert(alloc_page() == NULL);
 
     assert(nr_free == 0);
-    free_list = free_list_store;
-    nr_free = nr_free_store;
+    release_free_blocks(&held);
 
     free_page(p);
     free_page(p1);
     free_page(p2);
 }
 
+// huge_check - a single page comes from a block that holds no huge page
+// while there is one, and only then breaks up a free huge page
+static void
+huge_check(void) {
+    struct Page *h = alloc_pages_aligned(HUGE_PAGE_NR + 2, HUGE_PAGE_NR), *p;
+    assert(h != NULL);
+    list_entry_t held;
+    hold_free_blocks(&held);
+
+    // free: the huge page h and, past a page still held, h + HUGE_PAGE_NR + 1
+    free_page(h + HUGE_PAGE_NR + 1);
+    free_pages(h, HUGE_PAGE_NR);
+    assert((p = alloc_page()) == h + HUGE_PAGE_NR + 1);
+    assert((p = alloc_page()) == h);
+    assert(alloc_pages(HUGE_PAGE_NR) == NULL);
+    free_page(p);
+    assert((p = alloc_pages(HUGE_PAGE_NR)) == h);
+
+    assert(nr_free == 0);
+    release_free_blocks(&held);
+    free_pages(h, HUGE_PAGE_NR + 2);
+}
+
 // LAB2: below code is used to check the first fit allocation algorithm (your EXERCISE 1) 
 // NOTICE: You SHOULD NOT CHANGE basic_check, default_check functions!
 static void
@@ -248,14 +354,11 @@ default_check(void) {
     assert(p0 != NULL);
     assert(!PageProperty(p0));
 
-    list_entry_t free_list_store = free_list;
-    list_init(&free_list);
+    list_entry_t held;
+    hold_free_blocks(&held);
     assert(list_empty(&free_list));
     assert(alloc_page() == NULL);
 
-    unsigned int nr_free_store = nr_free;
-    nr_free = 0;
-
     free_pages(p0 + 2, 3);
     assert(alloc_pages(4) == NULL);
     assert(PageProperty(p0 + 2) && p0[2].property == 3);
@@ -280,9 +383,7 @@ default_check(void) {
     assert(alloc_page() == NULL);
 
     assert(nr_free == 0);
-    nr_free = nr_free_store;
-
-    free_list = free_list_store;
+    release_free_blocks(&held);
     free_pages(p0, 5);
 
     le = &free_list;
@@ -293,6 +394,14 @@ default_check(void) {
     assert(count == 0);
     assert(total == 0);
 }
+
+// default_pmm_check - the first fit checks above, then the huge page
+// preference of default_alloc_pages
+static void
+default_pmm_check(void) {
+    default_check();
+    huge_check();
+}
 //这个结构体在
 const struct pmm_manager default_pmm_manager = {
     .name = "default_pmm_manager",
@@ -301,6 +410,8 @@ const struct pmm_manager default_pmm_manager = {
     .alloc_pages = default_alloc_pages,
     .free_pages = default_free_pages,
     .nr_free_pages = default_nr_free_pages,
-    .check = default_check,
+    .check = default_pmm_check,
+    .stats = default_stats,
+    .alloc_pages_aligned = default_alloc_pages_aligned,
 };
 
@@ -10,6 +10,9 @@
 #define KERNTOP             (KERNBASE + KMEMSIZE) // 0x88000000对应的虚拟地址
 
 #define PHYSICAL_MEMORY_OFFSET      0xFFFFFFFF40000000
+// entry.S maps one 1 GiB gigapage at 0xFFFFFFFFC0000000, so physical memory
+// from 0x80000000 up to here is all the kernel can reach
+#define PHYSICAL_MEMORY_END         0xC0000000
 
 
 #define KSTACKPAGE          2                           // # of pages in kernel stack
@@ -30,15 +33,20 @@ typedef uintptr_t pde_t;
  * that convert Page to other data types, such as physical address.
  * */
 struct Page {
-    int ref;                        // page frame's reference counter
     uint64_t flags;                 // array of flags that describe the status of the page frame
+    int ref;                        // page frame's reference counter
     unsigned int property;          // the num of free block, used in first fit pm manager
     list_entry_t page_link;         // free list link
 };
 
+// the fields above are ordered so that struct Page has no padding: 32 bytes,
+// two descriptors per 64-byte cache line (checked in page_init)
+#define PAGE_DESC_MAX               32
+
 /* Flags describing the status of a page frame */
 #define PG_reserved                 0       // if this bit=1: the Page is reserved for kernel, cannot be used in alloc/free_pages; otherwise, this bit=0 
 #define PG_property                 1       // if this bit=1: the Page is the head page of a free memory block(contains some continuous_addrress pages), and can be used in alloc_pages; if this bit=0: if the Page is the the head page of a free memory block, then this Page and the memory block is alloced. Or this Page isn't the head page.
+#define PG_movable                  2       // if this bit=1: the Page is allocated and its owner can follow it to a new frame (see pmm_register_migrate), so pmm_compact may move it; free_pages clears it
 
 #define SetPageReserved(page)       set_bit(PG_reserved, &((page)->flags))
 #define ClearPageReserved(page)     clear_bit(PG_reserved, &((page)->flags))
@@ -46,6 +54,21 @@ struct Page {
 #define SetPageProperty(page)       set_bit(PG_property, &((page)->flags))
 #define ClearPageProperty(page)     clear_bit(PG_property, &((page)->flags))
 #define PageProperty(page)          test_bit(PG_property, &((page)->flags))
+#define SetPageMovable(page)        set_bit(PG_movable, &((page)->flags))
+#define ClearPageMovable(page)      clear_bit(PG_movable, &((page)->flags))
+#define PageMovable(page)           test_bit(PG_movable, &((page)->flags))
+
+/* *
+ * Non-atomic variants, for a struct Page that only the caller can reach: one
+ * being set up, one it has just allocated or is freeing, or a free block the
+ * pmm_manager works on with interrupts disabled.
+ * */
+#define __SetPageReserved(page)     __set_bit(PG_reserved, &((page)->flags))
+#define __ClearPageReserved(page)   __clear_bit(PG_reserved, &((page)->flags))
+#define __SetPageProperty(page)     __set_bit(PG_property, &((page)->flags))
+#define __ClearPageProperty(page)   __clear_bit(PG_property, &((page)->flags))
+#define __SetPageMovable(page)      __set_bit(PG_movable, &((page)->flags))
+#define __ClearPageMovable(page)    __clear_bit(PG_movable, &((page)->flags))
 
 // convert list entry to page
 #define le2page(le, member)                 \
@@ -32,10 +32,115 @@ const struct pmm_manager *pmm_manager;
 
 
 static void check_alloc_page(void);
+static void check_pcp(void);
+static void check_reclaim(void);
+static void check_alloc_aligned(void);
+static void check_compact(void);
+static void check_memmap(void);
 
-// init_pmm_manager - initialize a pmm_manager instance
+struct pmm_watermark pmm_watermark;
+
+#define PMM_WMARK_MIN       16  // lower bound for pmm_watermark.min, in pages
+#define MAX_RECLAIM         8   // number of reclaim callbacks that can be registered
+#define MAX_MIGRATE         8   // number of migrate callbacks that can be registered
+
+static pmm_reclaim_t reclaim_fns[MAX_RECLAIM];
+static int nr_reclaim_fns = 0;
+static size_t alloc_failures = 0;
+static pmm_migrate_t migrate_fns[MAX_MIGRATE];
+static int nr_migrate_fns = 0;
+
+/* *
+ * Deferred memmap. page_init sets up the struct Pages of the frames outside
+ * free memory and of the first MEMMAP_EAGER free frames only; the rest of
+ * each free memory region is left untouched and handed to pmm_manager in
+ * batches, when an allocation runs short (through pmm_reclaim) or from the
+ * idle loop (pmm_init_deferred). Boot time then no longer grows with the
+ * size of memory.
+ * */
+#define MEMMAP_EAGER        8192    // free frames set up at boot (32 MiB)
+#define MEMMAP_BATCH        4096    // free frames set up per batch after that
+
+// the free frames of one memory region, [base, end)
+struct memmap_range {
+    struct Page *base;
+    struct Page *next;              // first struct Page not set up yet
+    struct Page *end;
+};
+
+static struct memmap_range memmap_ranges[MEM_REGIONS_MAX];
+static int nr_memmap_ranges = 0;
+static bool memmap_enabled = 0;     // deferred frames count as free
+
+/* *
+ * Per-hart page caches (pcp). Single-page alloc/free hit a small LIFO list
+ * owned by the current hart, so the common path is one list push/pop with
+ * no call into pmm_manager; the list is refilled and drained in batches of
+ * PCP_BATCH pages. Harts numbered NCPU and up have no cache and go straight
+ * to pmm_manager. Each hart only touches its own cache, so the fast path
+ * takes no lock, but alloc_pages/free_pages still run it with interrupts
+ * disabled and pmm_manager behind it has no lock at all: it is lock-free
+ * only in the sense that ucore runs on one hart.
+ * */
+#define NCPU        4   // number of harts the caches are sized for
+#define PCP_HIGH    64  // drain when a hart caches this many pages
+#define PCP_BATCH   16  // pages moved per refill/drain
+
+struct pcp_cache {
+    list_entry_t list;  // cached pages, hottest at the head
+    size_t count;       // number of cached pages
+};
+
+static struct pcp_cache pcp_caches[NCPU];
+static bool pcp_enabled = 0;
+
+// cpuid - entry.S keeps the hartid in tp
+static inline int cpuid(void) {
+    uintptr_t hartid;
+    asm volatile("mv %0, tp" : "=r"(hartid));
+    return hartid;
+}
+
+// this_pcp - the current hart's page cache, NULL if caching is off or the
+// hart has none
+static inline struct pcp_cache *this_pcp(void) {
+    int id = cpuid();
+    if (!pcp_enabled || id >= NCPU) {
+        return NULL;
+    }
+    return &pcp_caches[id];
+}
+
+// pmm_managers - every manager built into the kernel, keyed by the name that
+// selects it with "pmm=<name>" in /chosen/bootargs; the first is the default.
+// best_fit_pmm.c is still the exercise skeleton, so it is not listed here
+static const struct {
+    const char *name;
+    const struct pmm_manager *manager;
+} pmm_managers[] = {
+    {"default", &default_pmm_manager},
+};
+
+// init_pmm_manager - initialize the pmm_manager chosen on the command line
 static void init_pmm_manager(void) {
-    pmm_manager = &default_pmm_manager;
+    const size_t nmanagers = sizeof(pmm_managers) / sizeof(pmm_managers[0]);
+    size_t len;
+    const char *want = get_bootarg("pmm", &len);
+    pmm_manager = pmm_managers[0].manager;
+    if (want != NULL) {
+        size_t i;
+        for (i = 0; i < nmanagers; i ++) {
+            if (strlen(pmm_managers[i].name) == len &&
+                strncmp(pmm_managers[i].name, want, len) == 0) {
+                pmm_manager = pmm_managers[i].manager;
+                break;
+            }
+        }
+        if (i == nmanagers) {
+            cprintf("unknown pmm=%.*s, using %s\n", (int)len, want,
+                    pmm_managers[0].name);
+        }
+    }
     cprintf("memory management: %s\n", pmm_manager->name);
     pmm_manager->init();
 }
@@ -45,78 +150,527 @@ static void init_memmap(struct Page *base, size_t n) {
     pmm_manager->init_memmap(base, n);
 }
 
+// pcp_refill - move up to PCP_BATCH pages from pmm_manager into the cache,
+// as one contiguous block if the manager has one, page by page otherwise
+static void pcp_refill(struct pcp_cache *pcp) {
+    struct Page *block = pmm_manager->alloc_pages(PCP_BATCH);
+    for (int i = 0; i < PCP_BATCH; i++) {
+        struct Page *page = block ? block + i : pmm_manager->alloc_pages(1);
+        if (page == NULL) {
+            break;
+        }
+        list_add_before(&(pcp->list), &(page->page_link));
+        pcp->count++;
+    }
+}
+
+// pcp_drain - give the n coldest cached pages back to pmm_manager
+static void pcp_drain(struct pcp_cache *pcp, size_t n) {
+    while (n-- > 0 && pcp->count > 0) {
+        list_entry_t *le = list_prev(&(pcp->list));
+        list_del(le);
+        pcp->count--;
+        pmm_manager->free_pages(le2page(le, page_link), 1);
+    }
+}
+
+static struct Page *pcp_alloc_page(struct pcp_cache *pcp) {
+    if (pcp->count == 0) {
+        pcp_refill(pcp);
+        if (pcp->count == 0) {
+            return NULL;
+        }
+    }
+    list_entry_t *le = list_next(&(pcp->list));
+    list_del(le);
+    pcp->count--;
+    return le2page(le, page_link);
+}
+
+static void pcp_free_page(struct pcp_cache *pcp, struct Page *page) {
+    list_add(&(pcp->list), &(page->page_link));
+    pcp->count++;
+    if (pcp->count >= PCP_HIGH) {
+        pcp_drain(pcp, PCP_BATCH);
+    }
+}
+
+// pcp_flush - give every page this hart caches back to pmm_manager; returns
+// how many there were
+static size_t pcp_flush(void) {
+    struct pcp_cache *pcp = this_pcp();
+    size_t n = 0;
+    if (pcp != NULL) {
+        n = pcp->count;
+        pcp_drain(pcp, n);
+    }
+    return n;
+}
+
+// pcp_init - start serving single pages from the per-hart caches
+static void pcp_init(void) {
+    for (int i = 0; i < NCPU; i++) {
+        list_init(&(pcp_caches[i].list));
+        pcp_caches[i].count = 0;
+    }
+    pcp_enabled = 1;
+}
+
+// memmap_deferred - free frames not handed to pmm_manager yet
+static size_t memmap_deferred(void) {
+    size_t n = 0;
+    if (memmap_enabled) {
+        for (int i = 0; i < nr_memmap_ranges; i++) {
+            n += memmap_ranges[i].end - memmap_ranges[i].next;
+        }
+    }
+    return n;
+}
+
+// memmap_deferred_start - NULL if the struct Page of page has been set up,
+// otherwise the first one not set up yet in its region
+static struct Page *memmap_deferred_start(struct Page *page) {
+    for (int i = 0; i < nr_memmap_ranges; i++) {
+        if (memmap_ranges[i].next <= page && page < memmap_ranges[i].end) {
+            return memmap_ranges[i].next;
+        }
+    }
+    return NULL;
+}
+
+// memmap_fence - set up the first struct Page past what r has set up as
+// reserved, so that the boundary tags of the free block ending right below
+// it never read one that is not
+static void memmap_fence(struct memmap_range *r) {
+    if (r->next < r->end) {
+        r->next->flags = r->next->property = 0;
+        __SetPageReserved(r->next);
+    }
+}
+
+// memmap_grow - set up deferred frames, lowest region first, in whole
+// batches until at least nr of them, or all, are free in pmm_manager;
+// returns the number set up
+static size_t memmap_grow(size_t nr) {
+    size_t n = ROUNDUP(nr, MEMMAP_BATCH), grown = 0;
+    if (n > memmap_deferred()) {
+        n = memmap_deferred();
+    }
+    for (int i = 0; i < nr_memmap_ranges && grown < n; i++) {
+        struct memmap_range *r = &memmap_ranges[i];
+        size_t chunk = r->end - r->next;
+        if (chunk > n - grown) {
+            chunk = n - grown;
+        }
+        if (chunk == 0) {
+            continue;
+        }
+        struct Page *base = r->next;
+        for (struct Page *p = base; p != base + chunk; p++) {
+            p->flags = p->property = 0;
+            set_page_ref(p, 0);
+        }
+        r->next += chunk;
+        memmap_fence(r);
+        // freed rather than added with init_memmap, so that the batch merges
+        // with the free block that ends right below it
+        pmm_manager->free_pages(base, chunk);
+        grown += chunk;
+    }
+    return grown;
+}
+
+// pmm_init_deferred - set up at least n more deferred frames, e.g. one batch
+// per pass of the idle loop; returns the number set up
+size_t pmm_init_deferred(size_t n) {
+    size_t ret;
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        ret = memmap_grow(n);
+    }
+    local_intr_restore(intr_flag);
+    return ret;
+}
+
+// pmm_register_reclaim - add fn to the callbacks run when memory is low
+int pmm_register_reclaim(pmm_reclaim_t fn) {
+    if (nr_reclaim_fns == MAX_RECLAIM) {
+        return -E_NO_MEM;
+    }
+    reclaim_fns[nr_reclaim_fns++] = fn;
+    return 0;
+}
+
+void pmm_unregister_reclaim(pmm_reclaim_t fn) {
+    for (int i = 0; i < nr_reclaim_fns; i++) {
+        if (reclaim_fns[i] == fn) {
+            reclaim_fns[i] = reclaim_fns[--nr_reclaim_fns];
+            return;
+        }
+    }
+}
+
+size_t nr_alloc_failures(void) {
+    return alloc_failures;
+}
+
+// pmm_reclaim - set up deferred frames, then run the reclaim callbacks in
+// registration order, until nr pages have been freed; returns the number
+// actually freed
+static size_t pmm_reclaim(size_t nr) {
+    size_t freed = memmap_grow(nr);
+    for (int i = 0; i < nr_reclaim_fns && freed < nr; i++) {
+        freed += reclaim_fns[i](nr - freed);
+    }
+    return freed;
+}
+
+// pmm_register_migrate - add fn to the callbacks that follow movable pages
+int pmm_register_migrate(pmm_migrate_t fn) {
+    if (nr_migrate_fns == MAX_MIGRATE) {
+        return -E_NO_MEM;
+    }
+    migrate_fns[nr_migrate_fns++] = fn;
+    return 0;
+}
+
+void pmm_unregister_migrate(pmm_migrate_t fn) {
+    for (int i = 0; i < nr_migrate_fns; i++) {
+        if (migrate_fns[i] == fn) {
+            migrate_fns[i] = migrate_fns[--nr_migrate_fns];
+            return;
+        }
+    }
+}
+
+// migrate_page - copy from into to and find the owner of from among the
+// migrate callbacks; on success to takes over the movable flag and ref
+static bool migrate_page(struct Page *from, struct Page *to) {
+    memcpy(page2kva(to), page2kva(from), PGSIZE);
+    for (int i = 0; i < nr_migrate_fns; i++) {
+        if (migrate_fns[i](from, to)) {
+            set_page_ref(to, page_ref(from));
+            __SetPageMovable(to);
+            set_page_ref(from, 0);
+            __ClearPageMovable(from);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* *
+ * pmm_compact - walk the frames from the top of memory down and move every
+ * movable page into the lowest free frame, as long as that frame lies below
+ * it. The manager picks the target: with first fit it is the lowest free
+ * frame, so movable pages pile up at the bottom and the free frames they
+ * leave merge at the top. The pass ends at the first page the manager
+ * cannot place lower, and never goes below the last target, so frames under
+ * the lowest free one are not walked. Without a migrate callback no page can
+ * move and it returns at once.
+ * */
+size_t pmm_compact(void) {
+    size_t moved = 0;
+    bool intr_flag;
+    if (nr_migrate_fns == 0) {
+        return 0;
+    }
+    local_intr_save(intr_flag);
+    {
+        // cached pages are free frames the manager cannot see or merge
+        pcp_flush();
+        struct Page *floor = pmm_manager->alloc_pages(1);
+        if (floor != NULL) {
+            pmm_manager->free_pages(floor, 1);
+        }
+        for (struct Page *p = pages + (npage - nbase); floor != NULL && p-- > floor;) {
+            struct Page *deferred = memmap_deferred_start(p);
+            if (deferred != NULL) {
+                p = deferred;   // skip the rest of the frames not set up
+                continue;
+            }
+            if (!PageMovable(p) || PageReserved(p) || page_ref(p) > 1) {
+                continue;
+            }
+            struct Page *to = pmm_manager->alloc_pages(1);
+            if (to == NULL) {
+                break;
+            }
+            if (to > p) {
+                pmm_manager->free_pages(to, 1);
+                break;
+            }
+            floor = to;
+            if (migrate_page(p, to)) {
+                pmm_manager->free_pages(p, 1);
+                moved++;
+            } else {
+                pmm_manager->free_pages(to, 1);
+            }
+        }
+    }
+    local_intr_restore(intr_flag);
+    return moved;
+}
+
+// manager_alloc_pages - n pages from pmm_manager, the first page number a
+// multiple of align. A manager without an aligned search of its own is asked
+// for a run long enough to hold an aligned one and the ends are given back;
+// such managers all accept frees of part of a block.
+static struct Page *manager_alloc_pages(size_t n, size_t align) {
+    if (align <= 1) {
+        return pmm_manager->alloc_pages(n);
+    }
+    if (pmm_manager->alloc_pages_aligned != NULL) {
+        return pmm_manager->alloc_pages_aligned(n, align);
+    }
+    struct Page *page = pmm_manager->alloc_pages(n + align - 1);
+    if (page == NULL) {
+        return NULL;
+    }
+    size_t head = ROUNDUP(page2ppn(page), align) - page2ppn(page);
+    if (head > 0) {
+        pmm_manager->free_pages(page, head);
+    }
+    if (align - 1 - head > 0) {
+        pmm_manager->free_pages(page + head + n, align - 1 - head);
+    }
+    return page + head;
+}
+
+// __alloc_pages - single pages from this hart's page cache, the rest from
+// pmm_manager
+static struct Page *__alloc_pages(size_t n, size_t align) {
+    struct pcp_cache *pcp = this_pcp();
+    if (n == 1 && align <= 1 && pcp != NULL) {
+        return pcp_alloc_page(pcp);
+    }
+    struct Page *page = manager_alloc_pages(n, align);
+    // cached pages may be what keeps the manager from merging
+    if (page == NULL && pcp_flush() > 0) {
+        page = manager_alloc_pages(n, align);
+    }
+    return page;
+}
+
 // alloc_pages - call pmm->alloc_pages to allocate a continuous n*PAGESIZE
-// memory
+// memory; single pages come from this hart's page cache
 struct Page *alloc_pages(size_t n) {
+    return alloc_pages_aligned(n, 1);
+}
+
+// alloc_pages_aligned - like alloc_pages, with the physical address of the
+// first page a multiple of align pages, e.g. 512 for an Sv39 megapage.
+// Reclaim runs before dipping below the min watermark or failing, and after
+// leaving fewer than low pages free; a multi-page request that still fails
+// compacts memory and tries once more.
+struct Page *alloc_pages_aligned(size_t n, size_t align) {
+    assert(align > 0 && (align & (align - 1)) == 0);
     struct Page *page = NULL;
     bool intr_flag;
     local_intr_save(intr_flag);
     {
-        page = pmm_manager->alloc_pages(n);
+        size_t nr_free = nr_free_pages();
+        if (nr_free < pmm_watermark.min + n) {
+            pmm_reclaim(pmm_watermark.high + n - nr_free);
+        }
+        page = __alloc_pages(n, align);
+        if (page == NULL && pmm_reclaim(pmm_watermark.high + n) > 0) {
+            page = __alloc_pages(n, align);
+        }
+        if (page == NULL && n > 1 && pmm_compact() > 0) {
+            page = __alloc_pages(n, align);
+        }
+        if (page == NULL) {
+            alloc_failures++;
+        } else if ((nr_free = nr_free_pages()) < pmm_watermark.low) {
+            pmm_reclaim(pmm_watermark.high - nr_free);
+        }
     }
     local_intr_restore(intr_flag);
     return page;
 }
 
-// free_pages - call pmm->free_pages to free a continuous n*PAGESIZE memory
+// alloc_huge_page - HUGE_PAGE_NR frames that a single megapage can map
+struct Page *alloc_huge_page(void) {
+    return alloc_pages_aligned(HUGE_PAGE_NR, HUGE_PAGE_NR);
+}
+
+void free_huge_page(struct Page *page) {
+    assert(page2ppn(page) % HUGE_PAGE_NR == 0);
+    free_pages(page, HUGE_PAGE_NR);
+}
+
+// free_pages - call pmm->free_pages to free a continuous n*PAGESIZE memory;
+// single pages go to this hart's page cache
 void free_pages(struct Page *base, size_t n) {
+    struct pcp_cache *pcp;
     bool intr_flag;
     local_intr_save(intr_flag);
     {
-        pmm_manager->free_pages(base, n);
+        for (size_t i = 0; i < n; i++) {
+            __ClearPageMovable(base + i);
+        }
+        if (n == 1 && (pcp = this_pcp()) != NULL) {
+            pcp_free_page(pcp, base);
+        } else {
+            pmm_manager->free_pages(base, n);
+        }
     }
     local_intr_restore(intr_flag);
 }
 
 // nr_free_pages - call pmm->nr_free_pages to get the size (nr*PAGESIZE)
-// of current free memory
+// of current free memory, including pages held in the per-hart caches and
+// frames not set up yet
 size_t nr_free_pages(void) {
     size_t ret;
     bool intr_flag;
     local_intr_save(intr_flag);
     {
-        ret = pmm_manager->nr_free_pages();
+        ret = pmm_manager->nr_free_pages() + memmap_deferred();
+        if (pcp_enabled) {
+            for (int i = 0; i < NCPU; i++) {
+                ret += pcp_caches[i].count;
+            }
+        }
     }
     local_intr_restore(intr_flag);
     return ret;
 }
 
+// pmm_get_stats - fill st from the manager's stats hook, with the pages in
+// the per-hart caches as cached; returns 0 if the manager has no hook
+bool pmm_get_stats(struct pmm_stats *st) {
+    memset(st, 0, sizeof(*st));
+    if (pmm_manager->stats == NULL) {
+        return 0;
+    }
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        pmm_manager->stats(st);
+        if (pcp_enabled) {
+            for (int i = 0; i < NCPU; i++) {
+                st->cached += pcp_caches[i].count;
+            }
+        }
+    }
+    local_intr_restore(intr_flag);
+    st->frag = st->nr_free ? (st->nr_free - st->largest) * 1000 / st->nr_free : 0;
+    return 1;
+}
+
+// print_pmm_stats - print free memory, the free block histogram and the
+// external fragmentation index of the current pmm_manager
+void print_pmm_stats(void) {
+    struct pmm_stats st;
+    if (!pmm_get_stats(&st)) {
+        cprintf("%s keeps no free block statistics\n", pmm_manager->name);
+        return;
+    }
+    cprintf("%s: %lu free pages (+%lu cached), largest block %lu, "
+            "fragmentation %u/1000\n", pmm_manager->name, st.nr_free,
+            st.cached, st.largest, st.frag);
+    cprintf("  free blocks by order:");
+    for (unsigned int k = 0; k < PMM_STATS_ORDERS; k ++) {
+        if (st.nr_blocks[k] != 0) {
+            cprintf(" %u:%lu", k, st.nr_blocks[k]);
+        }
+    }
+    cprintf("\n");
+}
+
 static void page_init(void) {
     va_pa_offset = PHYSICAL_MEMORY_OFFSET;
 
-    uint64_t mem_begin = get_memory_base();
-    uint64_t mem_size  = get_memory_size();
-    if (mem_size == 0) {
+    const struct mem_region *regions;
+    int nregions = get_memory_regions(&regions);
+    if (nregions == 0) {
         panic("DTB memory info not available");
     }
-    uint64_t mem_end   = mem_begin + mem_size;
 
     cprintf("physcial memory map:\n");
-    cprintf("  memory: 0x%016lx, [0x%016lx, 0x%016lx].\n", mem_size, mem_begin,
-            mem_end - 1);
+    for (int i = 0; i < nregions; i++) {
+        cprintf("  memory: 0x%016lx, [0x%016lx, 0x%016lx].\n", regions[i].size,
+                regions[i].base, regions[i].base + regions[i].size - 1);
+    }
 
-    uint64_t maxpa = mem_end;
+    // pages[] runs up to the end of the last region, or of what the boot
+    // page table maps if that comes first
+    uint64_t maxpa = regions[nregions - 1].base + regions[nregions - 1].size;
 
-    if (maxpa > KERNTOP) {
-        maxpa = KERNTOP;
+    if (maxpa > PHYSICAL_MEMORY_END) {
+        cprintf("  memory above 0x%016lx is not mapped, left unused.\n",
+                (uint64_t)PHYSICAL_MEMORY_END);
+        maxpa = PHYSICAL_MEMORY_END;
     }
 
     extern char end[];
 
+    static_assert(sizeof(struct Page) <= PAGE_DESC_MAX);
+    static_assert(PGSIZE % sizeof(struct Page) == 0);
+
     npage = maxpa / PGSIZE;
     pages = (struct Page *)ROUNDUP((void *)end, PGSIZE);
 
-    for (size_t i = 0; i < npage - nbase; i++) {
-        SetPageReserved(pages + i);
+    uintptr_t freemem = PADDR((uintptr_t)pages + sizeof(struct Page) * (npage - nbase));
+
+    // free memory is what the regions hold above pages[] and below maxpa;
+    // the first MEMMAP_EAGER frames of it are set up now, the rest later
+    size_t managed = 0, eager = 0;
+    for (int i = 0; i < nregions; i++) {
+        uint64_t mem_begin = ROUNDUP(regions[i].base, PGSIZE);
+        uint64_t mem_end = ROUNDDOWN(regions[i].base + regions[i].size, PGSIZE);
+        if (mem_begin < freemem) {
+            mem_begin = ROUNDUP(freemem, PGSIZE);
+        }
+        if (mem_end > maxpa) {
+            mem_end = maxpa;
+        }
+        if (mem_begin >= mem_end) {
+            continue;
+        }
+        size_t n = (mem_end - mem_begin) / PGSIZE;
+        size_t now = n < MEMMAP_EAGER - eager ? n : MEMMAP_EAGER - eager;
+        struct memmap_range *r = &memmap_ranges[nr_memmap_ranges++];
+        r->base = pa2page(mem_begin);
+        r->next = r->base + now;
+        r->end = r->base + n;
+        managed += n;
+        eager += now;
     }
 
-    uintptr_t freemem = PADDR((uintptr_t)pages + sizeof(struct Page) * (npage - nbase));
+    // reserve every frame but the deferred ones: the kernel, pages[], holes
+    // and reserved memory for good, the eager free frames until init_memmap
+    int i = 0;
+    for (struct Page *p = pages; p < pages + (npage - nbase);) {
+        if (i < nr_memmap_ranges && p == memmap_ranges[i].next) {
+            p = memmap_ranges[i++].end;
+            continue;
+        }
+        __SetPageReserved(p++);
+    }
+    for (i = 0; i < nr_memmap_ranges; i++) {
+        struct memmap_range *r = &memmap_ranges[i];
+        memmap_fence(r);
+        if (r->next > r->base) {
+            init_memmap(r->base, r->next - r->base);
+        }
+    }
+    cprintf("  memmap: %lu pages set up, %lu deferred.\n", eager, managed - eager);
 
-    mem_begin = ROUNDUP(freemem, PGSIZE);
-    mem_end = ROUNDDOWN(mem_end, PGSIZE);
-    if (freemem < mem_end) {
-        init_memmap(pa2page(mem_begin), (mem_end - mem_begin) / PGSIZE);
+    // watermarks scale with the managed memory: min is 1/128 of it, low and
+    // high leave a quarter and a half of min on top as headroom for reclaim
+    pmm_watermark.min = managed / 128;
+    if (pmm_watermark.min < PMM_WMARK_MIN) {
+        pmm_watermark.min = PMM_WMARK_MIN;
     }
+    pmm_watermark.low = pmm_watermark.min + pmm_watermark.min / 4;
+    pmm_watermark.high = pmm_watermark.min + pmm_watermark.min / 2;
+    cprintf("  watermarks: min %lu, low %lu, high %lu pages.\n",
+            pmm_watermark.min, pmm_watermark.low, pmm_watermark.high);
 }
 
 /* pmm_init - initialize the physical memory management */
@@ -135,6 +689,19 @@ void pmm_init(void) {
     // use pmm->check to verify the correctness of the alloc/free function in a pmm
     check_alloc_page();
 
+    // the checks above poke at the manager's free lists directly, so the
+    // per-hart page caches are only switched on once they have passed
+    pcp_init();
+    check_pcp();
+    check_reclaim();
+    check_alloc_aligned();
+    check_compact();
+
+    // the checks above count on the frames set up so far; only now do the
+    // deferred ones become free memory
+    memmap_enabled = 1;
+    check_memmap();
+
     extern char boot_page_table_sv39[];
     satp_virtual = (pte_t*)boot_page_table_sv39;
     satp_physical = PADDR(satp_virtual);
@@ -145,3 +712,227 @@ static void check_alloc_page(void) {
     pmm_manager->check();
     cprintf("check_alloc_page() succeeded!\n");
 }
+
+static void check_pcp(void) {
+    struct pcp_cache *pcp = this_pcp();
+    if (pcp == NULL) {
+        return;
+    }
+    size_t nr_free_store = nr_free_pages();
+
+    // the first single page refills the cache with a batch
+    struct Page *p0 = alloc_page();
+    assert(p0 != NULL && pcp->count == PCP_BATCH - 1);
+    assert(nr_free_pages() == nr_free_store - 1);
+
+    // a freed page is the next one handed out (hot, LIFO)
+    free_page(p0);
+    assert(pcp->count == PCP_BATCH);
+    assert(alloc_page() == p0);
+    free_page(p0);
+
+    // freeing past the high watermark drains a batch back to the manager
+    struct Page *pages_store[PCP_HIGH];
+    for (int i = 0; i < PCP_HIGH; i++) {
+        assert((pages_store[i] = alloc_page()) != NULL);
+    }
+    for (int i = 0; i < PCP_HIGH; i++) {
+        free_page(pages_store[i]);
+        assert(pcp->count < PCP_HIGH);
+    }
+    assert(nr_free_pages() == nr_free_store);
+
+    pcp_drain(pcp, pcp->count);
+    assert(pcp->count == 0 && nr_free_pages() == nr_free_store);
+    cprintf("check_pcp() succeeded!\n");
+}
+
+#define CHECK_STASH     8
+
+static list_entry_t check_stash;
+static size_t check_stash_count;
+
+// check_stash_reclaim - a reclaim callback handing back the stashed pages
+static size_t check_stash_reclaim(size_t nr) {
+    size_t freed = 0;
+    while (freed < nr && check_stash_count > 0) {
+        list_entry_t *le = list_next(&check_stash);
+        list_del(le);
+        check_stash_count--;
+        free_page(le2page(le, page_link));
+        freed++;
+    }
+    return freed;
+}
+
+static void check_reclaim(void) {
+    size_t nr_free_store = nr_free_pages();
+    size_t failures_store = nr_alloc_failures();
+    assert(pmm_watermark.min <= pmm_watermark.low && pmm_watermark.low <= pmm_watermark.high);
+
+    // pin a few pages behind a reclaim callback
+    list_init(&check_stash);
+    for (check_stash_count = 0; check_stash_count < CHECK_STASH; check_stash_count++) {
+        struct Page *p = alloc_page();
+        assert(p != NULL);
+        list_add(&check_stash, &(p->page_link));
+    }
+    assert(pmm_register_reclaim(check_stash_reclaim) == 0);
+
+    // take every page: reclaim hands back the stash before the first failure
+    list_entry_t held;
+    list_init(&held);
+    size_t count = 0;
+    struct Page *p;
+    while ((p = alloc_page()) != NULL) {
+        list_add(&held, &(p->page_link));
+        count++;
+    }
+    assert(count == nr_free_store && check_stash_count == 0);
+    assert(nr_alloc_failures() == failures_store + 1);
+
+    pmm_unregister_reclaim(check_stash_reclaim);
+    while (!list_empty(&held)) {
+        list_entry_t *le = list_next(&held);
+        list_del(le);
+        free_page(le2page(le, page_link));
+    }
+    assert(nr_free_pages() == nr_free_store);
+    cprintf("check_reclaim() succeeded!\n");
+}
+
+// check_alloc_aligned - aligned runs of several sizes, taken while a single
+// page is held so that free memory does not start out aligned
+static void check_alloc_aligned(void) {
+    static const size_t tests[][2] = {{1, 2}, {3, 16}, {16, 16}, {5, 512}, {512, 512}};
+    const size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    struct Page *p[sizeof(tests) / sizeof(tests[0])];
+    size_t nr_free_store = nr_free_pages();
+    struct Page *one = alloc_page();
+    assert(one != NULL);
+    for (size_t i = 0; i < ntests; i ++) {
+        size_t n = tests[i][0], align = tests[i][1], before = nr_free_pages();
+        assert((p[i] = alloc_pages_aligned(n, align)) != NULL);
+        assert(page2ppn(p[i]) % align == 0 && nr_free_pages() <= before - n);
+        for (size_t j = 0; j < i; j ++) {
+            assert(p[j] + tests[j][0] <= p[i] || p[i] + n <= p[j]);
+        }
+    }
+    for (size_t i = 0; i < ntests; i ++) {
+        free_pages(p[i], tests[i][0]);
+    }
+    struct Page *huge = alloc_huge_page();
+    assert(huge != NULL && page2ppn(huge) % HUGE_PAGE_NR == 0);
+    free_huge_page(huge);
+    free_page(one);
+    assert(nr_free_pages() == nr_free_store);
+    cprintf("check_alloc_aligned() succeeded!\n");
+}
+
+#define CHECK_MOVABLE   32
+
+static struct Page *check_movable[CHECK_MOVABLE];
+
+// check_migrate - a migrate callback following the pages in check_movable
+static bool check_migrate(struct Page *from, struct Page *to) {
+    for (int i = 0; i < CHECK_MOVABLE; i++) {
+        if (check_movable[i] == from) {
+            check_movable[i] = to;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// check_compact - take the largest free block and hold every other free
+// page, then free every other page of the block's first 2 * CHECK_MOVABLE
+// and mark the rest movable: no two free pages are adjacent until compaction
+// packs the movable ones together. A page held in the middle of free memory
+// first splits it the way a reservation inside a memory bank does.
+static void check_compact(void) {
+    pcp_flush();
+    size_t nr_free_store = nr_free_pages();
+    struct pmm_stats st;
+    assert(pmm_get_stats(&st) && st.largest >= 4 * CHECK_MOVABLE);
+    struct Page *split = alloc_pages(st.largest / 2 + 1);
+    assert(split != NULL);
+    free_pages(split, st.largest / 2);
+    split += st.largest / 2;
+
+    assert(pmm_get_stats(&st) && st.largest >= 2 * CHECK_MOVABLE);
+    size_t nr_base = st.largest;
+    struct Page *base = alloc_pages(nr_base), *p;
+    assert(base != NULL);
+    list_entry_t held;
+    list_init(&held);
+    while ((p = alloc_page()) != NULL) {
+        list_add(&held, &(p->page_link));
+    }
+    assert(nr_free_pages() == 0);
+    assert(pmm_register_migrate(check_migrate) == 0);
+
+    for (int i = 0; i < CHECK_MOVABLE; i++) {
+        check_movable[i] = base + 2 * i + 1;
+        __SetPageMovable(check_movable[i]);
+        *(uint64_t *)page2kva(check_movable[i]) = 0x5a5a0000 + i;
+        free_page(base + 2 * i);
+    }
+    assert(nr_free_pages() == CHECK_MOVABLE);
+    assert(pmm_manager->alloc_pages(2) == NULL);
+
+    // the failed request compacts: movable pages move down into the holes
+    // and the upper half of the range comes free as one block
+    p = alloc_pages(CHECK_MOVABLE);
+    assert(p == base + CHECK_MOVABLE && nr_free_pages() == 0);
+    for (int i = 0; i < CHECK_MOVABLE; i++) {
+        assert(check_movable[i] < base + CHECK_MOVABLE && PageMovable(check_movable[i]));
+        assert(*(uint64_t *)page2kva(check_movable[i]) == 0x5a5a0000 + i);
+    }
+    assert(pmm_compact() == 0);
+
+    pmm_unregister_migrate(check_migrate);
+    for (int i = 0; i < CHECK_MOVABLE; i++) {
+        free_page(check_movable[i]);
+    }
+    free_pages(p, CHECK_MOVABLE);
+    free_pages(base + 2 * CHECK_MOVABLE, nr_base - 2 * CHECK_MOVABLE);
+    while (!list_empty(&held)) {
+        list_entry_t *le = list_next(&held);
+        list_del(le);
+        free_page(le2page(le, page_link));
+    }
+    free_page(split);
+    pcp_flush();
+    assert(nr_free_pages() == nr_free_store);
+    cprintf("check_compact() succeeded!\n");
+}
+
+// check_memmap - deferred frames count as free, and running out of the ones
+// pmm_manager holds sets up more
+static void check_memmap(void) {
+    size_t nr_free_store = nr_free_pages(), deferred = memmap_deferred();
+    if (deferred == 0) {
+        return;
+    }
+    pcp_flush();
+    size_t n = pmm_manager->nr_free_pages() + 1;
+    list_entry_t held;
+    list_init(&held);
+    for (size_t i = 0; i < n; i++) {
+        struct Page *p = alloc_page();
+        assert(p != NULL);
+        list_add(&held, &(p->page_link));
+    }
+    assert(memmap_deferred() < deferred && nr_free_pages() == nr_free_store - n);
+    while (!list_empty(&held)) {
+        list_entry_t *le = list_next(&held);
+        list_del(le);
+        free_page(le2page(le, page_link));
+    }
+
+    size_t left = memmap_deferred(), grown = pmm_init_deferred(1);
+    assert(grown == (left < MEMMAP_BATCH ? left : MEMMAP_BATCH));
+    assert(memmap_deferred() == left - grown);
+    assert(nr_free_pages() == nr_free_store);
+    cprintf("check_memmap() succeeded!\n");
+}
@@ -8,6 +8,23 @@
 #include <mmu.h>
 #include <riscv.h>
 
+#define PMM_STATS_ORDERS    32
+
+// a huge page is the 2 MiB an Sv39 megapage (level-1 leaf PTE) maps: 512
+// frames, the first one 512-frame aligned
+#define HUGE_PAGE_ORDER     9
+#define HUGE_PAGE_NR        (1 << HUGE_PAGE_ORDER)
+
+// pmm_stats - a snapshot of free memory, see pmm_get_stats
+struct pmm_stats {
+    size_t nr_free;                         // free pages in the manager's blocks
+    size_t nr_blocks[PMM_STATS_ORDERS];     // free blocks of [2^k, 2^(k+1)) pages
+    size_t largest;                         // pages in the largest free block
+    size_t cached;                          // free pages held in caches outside them
+    unsigned int frag;                      // share of nr_free outside the largest
+                                            // block, in 1/1000
+};
+
 // pmm_manager is a physical memory management class. A special pmm manager -
 // XXX_pmm_manager
 // only needs to implement the methods in pmm_manager class, then
@@ -30,6 +47,11 @@ struct pmm_manager {
                                                       // structures(memlayout.h)
     size_t (*nr_free_pages)(void);  // return the number of free pages
     void (*check)(void);            // check the correctness of XXX_pmm_manager
+    void (*stats)(struct pmm_stats *st);  // optional: report every free block
+                                          // with pmm_stats_add_blocks
+    struct Page *(*alloc_pages_aligned)(
+        size_t n, size_t align);  // optional: n pages whose first page number
+                                  // is a multiple of align (a power of two)
 };
 
 extern const struct pmm_manager *pmm_manager;
@@ -37,8 +59,65 @@ extern const struct pmm_manager *pmm_manager;
 void pmm_init(void);
 
 struct Page *alloc_pages(size_t n);
+struct Page *alloc_pages_aligned(size_t n, size_t align); // align in pages
 void free_pages(struct Page *base, size_t n);
 size_t nr_free_pages(void); // number of free pages
+struct Page *alloc_huge_page(void);
+void free_huge_page(struct Page *page);
+size_t pmm_init_deferred(size_t n); // set up deferred frames, see pmm.c
+
+// pmm_stats_add_blocks - account count free blocks of n pages each
+static inline void pmm_stats_add_blocks(struct pmm_stats *st, size_t n, size_t count) {
+    unsigned int k = 0;
+    while (k + 1 < PMM_STATS_ORDERS && (n >> (k + 1)) != 0) {
+        k ++;
+    }
+    st->nr_blocks[k] += count;
+    st->nr_free += n * count;
+    if (count > 0 && n > st->largest) {
+        st->largest = n;
+    }
+}
+
+bool pmm_get_stats(struct pmm_stats *st);
+void print_pmm_stats(void);
+
+/* *
+ * Free-page watermarks, set up in page_init. An allocation that would dip
+ * below min, or that fails outright, first runs the registered reclaim
+ * callbacks; one that leaves fewer than low pages free runs them after the
+ * fact. Either way reclaim aims to bring free memory back up to high.
+ * */
+struct pmm_watermark {
+    size_t min, low, high;
+};
+
+extern struct pmm_watermark pmm_watermark;
+
+// a reclaim callback gives back up to nr pages and returns how many it freed
+typedef size_t (*pmm_reclaim_t)(size_t nr);
+
+int pmm_register_reclaim(pmm_reclaim_t fn);
+void pmm_unregister_reclaim(pmm_reclaim_t fn);
+size_t nr_alloc_failures(void); // number of allocations that returned NULL
+
+/* *
+ * Compaction. An owner that can follow one of its pages to another frame
+ * marks it with SetPageMovable and registers a migrate callback. When a
+ * multi-page allocation fails, pmm_compact moves movable pages down into the
+ * lowest free frames, so that the frames they leave behind merge into larger
+ * free blocks at the top of memory. Pages with more than one reference are
+ * never moved.
+ * */
+
+// a migrate callback is offered a movable page that has already been copied
+// to a new frame; it returns 1 if the page is its own and every reference to
+// from now points to to, 0 to let the next callback look at it
+typedef bool (*pmm_migrate_t)(struct Page *from, struct Page *to);
+
+int pmm_register_migrate(pmm_migrate_t fn);
+void pmm_unregister_migrate(pmm_migrate_t fn);
+size_t pmm_compact(void);       // returns the number of pages moved
 
 #define alloc_page() alloc_pages(1)
 #define free_page(page) free_pages(page, 1)
@@ -87,6 +166,10 @@ static inline uintptr_t page2pa(struct Page *page) {
     return page2ppn(page) << PGSHIFT;
 }
 
+static inline void *page2kva(struct Page *page) {
+    return (void *)(page2pa(page) + va_pa_offset);
+}
+
 
 
 static inline int page_ref(struct Page *page) { return page->ref; }
@@ -108,6 +191,45 @@ static inline struct Page *pa2page(uintptr_t pa) {
     }
     return &pages[PPN(pa) - nbase];
 }
+
+/* *
+ * Boundary tags - a free block of n pages has PG_property set on its head
+ * page, and property = n on both its head and its last page. Given a block
+ * [base, base + n) that is being freed, the free blocks physically next to
+ * it can then be found in O(1), without walking any free list.
+ * */
+static inline void set_block_tags(struct Page *base, size_t n) {
+    base->property = n;
+    base[n - 1].property = n;
+    __SetPageProperty(base);
+}
+
+// next_free_block - the free block starting right after [base, base + n)
+static inline struct Page *next_free_block(struct Page *base, size_t n) {
+    struct Page *next = base + n;
+    if (next < pages + (npage - nbase) && PageProperty(next)) {
+        return next;
+    }
+    return NULL;
+}
+
+// prev_free_block - the free block ending right before base. The tail's
+// property may be stale if that page is not free, so the head it points
+// to must agree on the size.
+static inline struct Page *prev_free_block(struct Page *base) {
+    if (base <= pages) {
+        return NULL;
+    }
+    struct Page *tail = base - 1;
+    if (tail->property == 0 || tail->property > tail - pages + 1) {
+        return NULL;
+    }
+    struct Page *head = tail - tail->property + 1;
+    if (PageProperty(head) && head->property == tail->property) {
+        return head;
+    }
+    return NULL;
+}
 static inline void flush_tlb() { asm volatile("sfence.vm"); }
 extern char bootstack[], bootstacktop[]; // defined in entry.S
 
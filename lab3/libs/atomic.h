@@ -106,4 +106,25 @@ static inline bool test_and_clear_bit(int nr, volatile void *addr) {
     return __test_and_op_bit(and, __NOT, nr, ((volatile unsigned long *)addr));
 }
 
+/* *
+ * __set_bit - Set a bit in memory, non-atomically
+ * @nr:     the bit to set
+ * @addr:   the address to start counting from
+ *
+ * A plain load and store rather than an AMO: only for a word that nothing
+ * else can be updating at the same time.
+ * */
+static inline void __set_bit(int nr, void *addr) {
+    ((unsigned long *)addr)[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+/* *
+ * __clear_bit - Clear a bit in memory, non-atomically
+ * @nr:     the bit to clear
+ * @addr:   the address to start counting from
+ * */
+static inline void __clear_bit(int nr, void *addr) {
+    ((unsigned long *)addr)[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
 #endif /* !__LIBS_ATOMIC_H__ */